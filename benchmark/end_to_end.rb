@@ -0,0 +1,331 @@
+#!/usr/bin/env ruby
+
+# generates benchmark tables in a pair of local databases, changes some of the rows at the 'to' end, runs ks to
+# put them back, and records how long it took, the CPU time and peak memory use of each process, and the data
+# transferred.  each run is appended as a line of JSON to the results file, so that runs before and after a change,
+# or with different options, can be compared.  see TESTS.md for how to run it.
+
+require 'rubygems'
+require 'optparse'
+require 'json'
+require 'uri'
+require 'time'
+require 'fileutils'
+require 'tempfile'
+require 'pg'
+require 'mysql2'
+
+class BenchmarkDatabase
+  attr_reader :url, :protocol
+
+  def self.connect(url)
+    raise "Invalid database URL #{url}" unless url =~ %r{\A(\w+)://(?:([^:@/]*)(?::([^@/]*))?@)?([^:/]*)(?::(\d+))?/(.+)\z}
+    protocol, username, password, host, port, name = [$1, $2, $3, $4, $5, $6].collect {|part| part && URI.decode_www_form_component(part)}
+    case protocol
+    when "postgresql" then PostgreSQLBenchmarkDatabase.new(url, protocol, host, port, name, username, password)
+    when "mysql"      then MySQLBenchmarkDatabase.new(url, protocol, host, port, name, username, password)
+    else raise "Don't know how to benchmark #{protocol} databases"
+    end
+  end
+
+  def initialize(url, protocol)
+    @url = url
+    @protocol = protocol
+  end
+
+  def create_table(name, key_shape)
+    execute "DROP TABLE IF EXISTS #{name}"
+    execute "CREATE TABLE #{name} (#{key_columns(key_shape).collect {|column, type| "#{column} #{type} NOT NULL"}.join(", ")}, " \
+            "amount INT, payload #{text_type}, data #{blob_type}, PRIMARY KEY (#{key_columns(key_shape).keys.join(", ")}))"
+  end
+
+  def key_columns(key_shape)
+    case key_shape
+    when "int"       then {"id" => "BIGINT"}
+    when "composite" then {"account_id" => "INT", "entry_id" => "INT"}
+    when "varchar"   then {"code" => "VARCHAR(40)"}
+    end
+  end
+
+  def insert_rows(table, columns, rows)
+    execute "INSERT INTO #{table} (#{columns.join(", ")}) VALUES #{rows.collect {|row| "(#{row.collect {|value| literal(value)}.join(", ")})"}.join(", ")}"
+  end
+
+  def literal(value)
+    case value
+    when nil     then "NULL"
+    when Integer then value.to_s
+    when BinaryData then binary_literal(value.data)
+    else "'#{value}'" # the generated strings are alphanumeric, so don't need escaping
+    end
+  end
+
+  def analyze(table)
+  end
+end
+
+class PostgreSQLBenchmarkDatabase < BenchmarkDatabase
+  def initialize(url, protocol, host, port, name, username, password)
+    super(url, protocol)
+    @connection = PGconn.connect(host, port, nil, nil, name, username, password)
+    @connection.exec("SET client_min_messages TO WARNING")
+  end
+
+  def execute(sql)
+    @connection.exec(sql)
+  end
+
+  def text_type; "TEXT"; end
+  def blob_type; "BYTEA"; end
+
+  def binary_literal(data)
+    "decode('#{data.unpack("H*").first}', 'hex')"
+  end
+
+  def analyze(table)
+    execute "ANALYZE #{table}"
+  end
+end
+
+class MySQLBenchmarkDatabase < BenchmarkDatabase
+  def initialize(url, protocol, host, port, name, username, password)
+    super(url, protocol)
+    @connection = Mysql2::Client.new(:host => host, :port => port.to_i, :database => name, :username => username, :password => password)
+  end
+
+  def execute(sql)
+    @connection.query(sql)
+  end
+
+  def text_type; "LONGTEXT"; end
+  def blob_type; "LONGBLOB"; end
+
+  def binary_literal(data)
+    "X'#{data.unpack("H*").first}'"
+  end
+
+  def analyze(table)
+    execute "ANALYZE TABLE #{table}"
+  end
+end
+
+BinaryData = Struct.new(:data)
+
+class DatasetGenerator
+  TABLE = "ks_benchmark"
+  BATCH_SIZE = 500
+  CHARACTERS = [*"a".."z", *"A".."Z", *"0".."9"]
+
+  def initialize(options)
+    @options = options
+  end
+
+  def key_values(index)
+    case @options[:key]
+    when "int"       then [index + 1]
+    when "composite" then [index / 1000 + 1, index % 1000 + 1]
+    when "varchar"   then ["key#{"%012d" % (index + 1)}"]
+    end
+  end
+
+  def random_string(random, length)
+    Array.new(length) { CHARACTERS[random.rand(CHARACTERS.size)] }.join
+  end
+
+  # rows are generated from a random number sequence seeded by their index, so the same rows are made every time
+  def row(index, version = 0)
+    random = Random.new(@options[:seed] * 1_000_003 + index * 7 + version)
+    blob = random.rand < @options[:blob_ratio]
+    payload_length = blob ? 16 : @options[:row_width]
+    key_values(index) + [random.rand(2**31), random_string(random, payload_length), (BinaryData.new(random.bytes(@options[:row_width])) if blob)]
+  end
+
+  def columns(database)
+    database.key_columns(@options[:key]).keys + %w(amount payload data)
+  end
+
+  def generate(database)
+    database.create_table(TABLE, @options[:key])
+    (0...@options[:rows]).each_slice(BATCH_SIZE) do |indices|
+      database.insert_rows(TABLE, columns(database), indices.collect {|index| row(index)})
+    end
+    database.analyze(TABLE)
+  end
+
+  # picks the rows to change at the 'to' end, spread according to the chosen distribution
+  def changed_rows(run)
+    count = (@options[:rows] * @options[:change]).round
+    random = Random.new(@options[:seed] + run)
+    case @options[:distribution]
+    when "uniform"   then (0...@options[:rows]).to_a.sample(count, random: random).sort
+    when "clustered" then start = random.rand([@options[:rows] - count, 1].max); (start...start + count).to_a
+    when "tail"      then ((@options[:rows] - count)...@options[:rows]).to_a
+    end
+  end
+
+  def change(database, run)
+    key_columns = database.key_columns(@options[:key]).keys
+    changed_rows(run).each_slice(BATCH_SIZE).each_with_index do |indices, batch|
+      where = indices.collect {|index| "(#{key_columns.zip(key_values(index)).collect {|column, value| "#{column} = #{database.literal(value)}"}.join(" AND ")})"}.join(" OR ")
+      if @options[:mutation] == "delete" || (@options[:mutation] == "mixed" && batch.odd?)
+        database.execute "DELETE FROM #{TABLE} WHERE #{where}"
+      else
+        database.execute "UPDATE #{TABLE} SET amount = amount + 1, payload = #{database.literal(row(indices.first, run + 1)[-2])} WHERE #{where}"
+      end
+    end
+  end
+end
+
+# samples the CPU time and peak memory use of ks and the endpoints it starts, which it can't report itself
+class ProcessSampler
+  CLOCK_TICKS = (`getconf CLK_TCK`.to_i rescue 100).nonzero? || 100
+
+  def initialize(root_pid)
+    @root_pid = root_pid
+    @processes = {}
+  end
+
+  def sample
+    parents = {}
+    Dir.glob("/proc/[0-9]*/stat").each do |path|
+      stat = File.read(path) rescue next
+      pid, rest = stat.split(" ", 2)
+      fields = rest.sub(/\A\(.*\) /m, "").split(" ") # the command name may contain spaces
+      parents[pid.to_i] = [fields[1].to_i, fields[11].to_i + fields[12].to_i] # ppid, utime + stime
+    end
+
+    descendants = [@root_pid]
+    descendants.each do |pid|
+      parents.each {|child, (ppid, _)| descendants << child if ppid == pid && !descendants.include?(child)}
+    end
+
+    descendants.each do |pid|
+      next unless parents[pid]
+      process = (@processes[pid] ||= {"name" => process_name(pid)})
+      process["cpu_seconds"] = parents[pid][1].to_f/CLOCK_TICKS
+      peak = File.read("/proc/#{pid}/status")[/^VmHWM:\s+(\d+)/, 1] rescue nil
+      process["peak_rss_kb"] = [process["peak_rss_kb"].to_i, peak.to_i].max if peak
+    end
+  end
+
+  def process_name(pid)
+    args = File.read("/proc/#{pid}/cmdline").split("\0") rescue []
+    # the endpoints are told whether they're the 'from' or 'to' end by their first argument, but the 'from' end
+    # overwrites its arguments with its status
+    name = File.basename(args[0].to_s)
+    name += (args[1] == "to" ? " to" : " from") if name.start_with?("ks_")
+    name
+  end
+
+  # the endpoints for each worker are combined, taking the total CPU time and the largest process's memory use
+  def summary
+    @processes.values.group_by {|process| process["name"]}.collect do |name, processes|
+      {"name" => name, "processes" => processes.size, "cpu_seconds" => processes.sum {|process| process["cpu_seconds"].to_f}.round(2), "peak_rss_kb" => processes.collect {|process| process["peak_rss_kb"].to_i}.max}
+    end
+  end
+end
+
+def run_ks(options, run)
+  metrics_file = Tempfile.new(["ks_benchmark_metrics", ".json"])
+  command = [options[:ks], "--from", options[:from], "--to", options[:to], "--workers", options[:workers].to_s, "--metrics-file", metrics_file.path] + options[:ks_args]
+
+  times_before = Process.times
+  started = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  pid = Process.spawn(*command, :out => File::NULL)
+  sampler = ProcessSampler.new(pid)
+  status = nil
+  until status
+    sampler.sample
+    sleep 0.05
+    _, status = Process.waitpid2(pid, Process::WNOHANG)
+  end
+  wall_seconds = Process.clock_gettime(Process::CLOCK_MONOTONIC) - started
+  times_after = Process.times
+
+  metrics = JSON.parse(File.read(metrics_file.path)) rescue {"workers" => []}
+  metrics_file.close!
+
+  {
+    "time" => Time.now.utc.iso8601,
+    "revision" => `git -C #{File.dirname(__FILE__)} rev-parse --short HEAD 2>/dev/null`.strip,
+    "run" => run,
+    "from" => options[:from].sub(/:[^:@\/]*@/, "@"), # don't record passwords
+    "to" => options[:to].sub(/:[^:@\/]*@/, "@"),
+    "rows" => options[:rows],
+    "row_width" => options[:row_width],
+    "key" => options[:key],
+    "blob_ratio" => options[:blob_ratio],
+    "change" => options[:change],
+    "distribution" => options[:distribution],
+    "mutation" => options[:mutation],
+    "workers" => options[:workers],
+    "ks_args" => options[:ks_args],
+    "exit_status" => status.exitstatus,
+    "wall_seconds" => wall_seconds.round(3),
+    "cpu_seconds" => ((times_after.cutime + times_after.cstime) - (times_before.cutime + times_before.cstime)).round(2),
+    "bytes_sent" => metrics["workers"].sum {|worker| worker["bytes_sent"].to_i},
+    "bytes_received" => metrics["workers"].sum {|worker| worker["bytes_received"].to_i},
+    "processes" => sampler.summary,
+  }
+end
+
+options = {
+  :ks => File.expand_path("../build/ks", File.dirname(__FILE__)),
+  :rows => 100_000,
+  :row_width => 100,
+  :key => "int",
+  :blob_ratio => 0.0,
+  :change => 0.001,
+  :distribution => "uniform",
+  :mutation => "update",
+  :workers => 1,
+  :runs => 3,
+  :seed => 1,
+  :generate => true,
+  :ks_args => [],
+  :results => File.join(File.dirname(__FILE__), "results.jsonl"),
+}
+
+OptionParser.new do |opts|
+  opts.banner = "Usage: end_to_end.rb --from URL --to URL [options]"
+  opts.on("--from URL", "Database to copy from (a ks database URL)") {|value| options[:from] = value}
+  opts.on("--to URL", "Database to copy to") {|value| options[:to] = value}
+  opts.on("--ks PATH", "ks program to run (default #{options[:ks]})") {|value| options[:ks] = value}
+  opts.on("--rows N", Integer, "Number of rows to generate (default #{options[:rows]})") {|value| options[:rows] = value}
+  opts.on("--row-width BYTES", Integer, "Size of the text or blob in each row (default #{options[:row_width]})") {|value| options[:row_width] = value}
+  opts.on("--key SHAPE", %w(int composite varchar), "Primary key: int, composite or varchar (default #{options[:key]})") {|value| options[:key] = value}
+  opts.on("--blob-ratio FRACTION", Float, "Fraction of rows with their data in a blob rather than text (default #{options[:blob_ratio]})") {|value| options[:blob_ratio] = value}
+  opts.on("--change FRACTION", Float, "Fraction of rows to change at the 'to' end before each run (default #{options[:change]})") {|value| options[:change] = value}
+  opts.on("--distribution NAME", %w(uniform clustered tail), "Which rows to change: uniform, clustered or tail (default #{options[:distribution]})") {|value| options[:distribution] = value}
+  opts.on("--mutation KIND", %w(update delete mixed), "How to change them: update, delete or mixed (default #{options[:mutation]})") {|value| options[:mutation] = value}
+  opts.on("--workers N", Integer, "Number of ks workers (default #{options[:workers]})") {|value| options[:workers] = value}
+  opts.on("--runs N", Integer, "Number of times to change the rows and run ks (default #{options[:runs]})") {|value| options[:runs] = value}
+  opts.on("--seed N", Integer, "Seed for the generated data and changes (default #{options[:seed]})") {|value| options[:seed] = value}
+  opts.on("--[no-]generate", "Create and fill the tables first (default yes; use --no-generate to reuse them)") {|value| options[:generate] = value}
+  opts.on("--ks-args ARGS", "Extra arguments to pass to ks") {|value| options[:ks_args] = value.split}
+  opts.on("--results FILE", "File to append the results to (default #{options[:results]})") {|value| options[:results] = value}
+end.parse!
+
+abort "Both --from and --to must be given" unless options[:from] && options[:to]
+abort "Can't see a ks program at #{options[:ks]}" unless File.executable?(options[:ks])
+
+from = BenchmarkDatabase.connect(options[:from])
+to = BenchmarkDatabase.connect(options[:to])
+generator = DatasetGenerator.new(options)
+
+if options[:generate]
+  puts "generating #{options[:rows]} rows"
+  generator.generate(from)
+  generator.generate(to)
+end
+
+File.open(options[:results], "a") do |results|
+  options[:runs].times do |run|
+    generator.change(to, run)
+    result = run_ks(options, run)
+    results.puts result.to_json
+    results.flush
+    puts "run #{run + 1}: #{result["wall_seconds"]}s wall, #{result["cpu_seconds"]}s CPU, #{result["bytes_received"]} bytes received, " \
+         "exit status #{result["exit_status"]}; #{result["processes"].collect {|process| "#{process["name"]} #{process["cpu_seconds"]}s CPU #{process["peak_rss_kb"]}KB"}.join(", ")}"
+  end
+end
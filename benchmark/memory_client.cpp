@@ -0,0 +1,115 @@
+#include "memory_client.h"
+
+static std::mutex registry_mutex;
+static map<string, MemoryDatabase*> registry;
+
+MemoryDatabase::MemoryDatabase(const string &name): name(name), statements_executed(0), statement_bytes(0) {
+	std::unique_lock<std::mutex> lock(registry_mutex);
+	if (registry.count(name)) throw logic_error("Memory database " + name + " already exists");
+	registry[name] = this;
+}
+
+MemoryDatabase::~MemoryDatabase() {
+	std::unique_lock<std::mutex> lock(registry_mutex);
+	registry.erase(name);
+}
+
+MemoryTable &MemoryDatabase::add_table(const Table &table) {
+	MemoryTable &memory_table(tables[table.name]);
+	memory_table.table = table;
+	return memory_table;
+}
+
+MemoryDatabase &MemoryDatabase::named(const string &name) {
+	std::unique_lock<std::mutex> lock(registry_mutex);
+	map<string, MemoryDatabase*>::iterator it = registry.find(name);
+	if (it == registry.end()) throw runtime_error("Unknown memory database " + name);
+	return *it->second;
+}
+
+void MemoryClient::execute(const string &sql) {
+	std::unique_lock<std::mutex> lock(database.mutex);
+	database.statements_executed++;
+	database.statement_bytes += sql.size();
+}
+
+const vector<PackedRow> &MemoryClient::rows_of(const Table &table) {
+	map<string, MemoryTable>::const_iterator it = database.tables.find(table.name);
+	if (it == database.tables.end()) throw runtime_error("Unknown table " + table.name);
+	return it->second.rows;
+}
+
+void MemoryClient::range(const Table &table, const vector<PackedRow> &rows, const ColumnValues &prev_key, const ColumnValues &last_key, vector<PackedRow>::const_iterator &begin, vector<PackedRow>::const_iterator &end) {
+	// the rows are sorted by primary key, so the range is found by binary search, as the database would use its index
+	begin = rows.begin();
+	end = rows.end();
+	if (!prev_key.empty()) {
+		begin = upper_bound(rows.begin(), rows.end(), prev_key, [&](const ColumnValues &key, const PackedRow &row) { return compare_row_key(table, row, key) > 0; });
+	}
+	if (!last_key.empty()) {
+		end = upper_bound(begin, rows.end(), last_key, [&](const ColumnValues &key, const PackedRow &row) { return compare_row_key(table, row, key) > 0; });
+	}
+}
+
+void MemoryClient::populate_database_schema(Database &database) {
+	for (const pair<const string, MemoryTable> &entry : this->database.tables) {
+		Table table(entry.second.table);
+		table.estimated_rows = entry.second.rows.size();
+		for (const PackedRow &row : entry.second.rows) {
+			for (const PackedValue &value : row) table.estimated_size += value.size();
+		}
+		database.tables.push_back(table);
+	}
+}
+
+string MemoryClient::escape_value(const string &value) {
+	string result;
+	append_escaped_value_to(result, value.data(), value.size());
+	return result;
+}
+
+string MemoryClient::escape_column_value(const Column &column, const string &value) {
+	string result;
+	append_escaped_column_value_to(result, column, value.data(), value.size());
+	return result;
+}
+
+void MemoryClient::append_escaped_value_to(string &result, const char *value, size_t length) {
+	result.reserve(result.size() + length);
+	for (const char *end = value + length; value != end; ++value) {
+		if (*value == '\'') result += '\'';
+		result += *value;
+	}
+}
+
+void MemoryClient::append_escaped_column_value_to(string &result, const Column &, const char *value, size_t length) {
+	append_escaped_value_to(result, value, length);
+}
+
+string MemoryClient::column_type(const Column &column) {
+	if (column.size) return column.column_type + "(" + to_string(column.size) + ")";
+	return column.column_type;
+}
+
+string MemoryClient::column_sequence_name(const Table &table, const Column &column) {
+	return table.name + "_" + column.name + "_seq";
+}
+
+string MemoryClient::column_default(const Table &, const Column &column) {
+	if (column.default_type == DefaultType::default_value) {
+		return " DEFAULT '" + escape_column_value(column, column.default_value) + "'";
+	}
+	return "";
+}
+
+string MemoryClient::column_definition(const Table &table, const Column &column) {
+	string result;
+	result += quote_identifiers_with();
+	result += column.name;
+	result += quote_identifiers_with();
+	result += ' ';
+	result += column_type(column);
+	if (!column.nullable) result += " NOT NULL";
+	result += column_default(table, column);
+	return result;
+}
@@ -0,0 +1,181 @@
+#ifndef MEMORY_CLIENT_H
+#define MEMORY_CLIENT_H
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include "../src/schema.h"
+#include "../src/encode_packed.h"
+#include "../src/sql_functions.h"
+
+using namespace std;
+
+// a table held in memory, with its rows kept sorted by primary key
+struct MemoryTable {
+	Table table;
+	vector<PackedRow> rows;
+};
+
+// a named set of tables that MemoryClient connections can find by database name, standing in for a database server.
+// the statements the 'to' end would run to apply changes are counted but not executed, since parsing them back
+// would cost far more than the database would; the benchmarks measure the protocol, not the apply path.
+struct MemoryDatabase {
+	MemoryDatabase(const string &name);
+	~MemoryDatabase();
+
+	MemoryTable &add_table(const Table &table);
+	static MemoryDatabase &named(const string &name);
+
+	string name;
+	map<string, MemoryTable> tables;
+	size_t statements_executed;
+	size_t statement_bytes;
+	std::mutex mutex;
+};
+
+// orders primary key values the way the databases do for the integer and binary-collated string key types
+inline int compare_key_values(const PackedValue &a, const PackedValue &b) {
+	if (a.is_nil() || b.is_nil()) return (int)!a.is_nil() - (int)!b.is_nil();
+
+	uint8_t leader = a.leader();
+	if (leader < MSGPACK_FIXRAW_MIN || (leader > MSGPACK_FIXRAW_MAX && leader != MSGPACK_RAW16 && leader != MSGPACK_RAW32)) {
+		VectorReadStream a_stream(a), b_stream(b);
+		Unpacker<VectorReadStream> a_unpacker(a_stream), b_unpacker(b_stream);
+		int64_t a_value = a_unpacker.template next<int64_t>(), b_value = b_unpacker.template next<int64_t>();
+		return (a_value < b_value ? -1 : a_value > b_value ? 1 : 0);
+	}
+
+	size_t a_length, b_length;
+	const char *a_data = packed_string_data(a, a_length);
+	const char *b_data = packed_string_data(b, b_length);
+	int result = memcmp(a_data, b_data, min(a_length, b_length));
+	if (result) return result;
+	return (a_length < b_length ? -1 : a_length > b_length ? 1 : 0);
+}
+
+inline int compare_row_key(const Table &table, const PackedRow &row, const ColumnValues &key) {
+	for (size_t n = 0; n < table.primary_key_columns.size(); n++) {
+		int result = compare_key_values(row[table.primary_key_columns[n]], key[n]);
+		if (result) return result;
+	}
+	return 0;
+}
+
+inline bool row_key_less(const Table &table, const PackedRow &a, const PackedRow &b) {
+	for (size_t column : table.primary_key_columns) {
+		int result = compare_key_values(a[column], b[column]);
+		if (result) return result < 0;
+	}
+	return false;
+}
+
+class MemoryRow {
+public:
+	inline MemoryRow(const PackedRow &row): row(row) {}
+
+	inline int n_columns() const { return row.size(); }
+
+	template <typename Packer>
+	inline void pack_column_into(Packer &packer, int column_number) const {
+		packer << row[column_number];
+	}
+
+	template <typename Packer>
+	void pack_row_into(Packer &packer) const {
+		pack_array_length(packer, row.size());
+
+		for (const PackedValue &value : row) {
+			packer << value;
+		}
+	}
+
+private:
+	const PackedRow &row;
+};
+
+class MemoryClient {
+public:
+	typedef MemoryRow RowType;
+
+	MemoryClient(
+		const string & /* database_host */,
+		const string & /* database_port */,
+		const string &database_name,
+		const string & /* database_username */,
+		const string & /* database_password */): database(MemoryDatabase::named(database_name)) {}
+
+	template <typename RowReceiver>
+	size_t retrieve_rows(RowReceiver &row_receiver, const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key, ssize_t row_count = NO_ROW_COUNT_LIMIT) {
+		const vector<PackedRow> &rows(rows_of(table));
+		vector<PackedRow>::const_iterator begin, end;
+		range(table, rows, prev_key, last_key, begin, end);
+		if (row_count != NO_ROW_COUNT_LIMIT && end - begin > row_count) end = begin + row_count;
+
+		for (vector<PackedRow>::const_iterator row = begin; row != end; ++row) {
+			MemoryRow memory_row(*row);
+			row_receiver(memory_row);
+		}
+		return end - begin;
+	}
+
+	size_t count_rows(const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key) {
+		const vector<PackedRow> &rows(rows_of(table));
+		vector<PackedRow>::const_iterator begin, end;
+		range(table, rows, prev_key, last_key, begin, end);
+		return end - begin;
+	}
+
+	bool retrieve_key_after_rows(ColumnValues &key, const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key, size_t rows) {
+		const vector<PackedRow> &rows_in_table(rows_of(table));
+		vector<PackedRow>::const_iterator begin, end;
+		range(table, rows_in_table, prev_key, last_key, begin, end);
+		if ((size_t)(end - begin) < rows) return false;
+
+		const PackedRow &row(*(begin + rows - 1));
+		key.clear();
+		for (size_t column : table.primary_key_columns) key.push_back(row[column]);
+		return true;
+	}
+
+	void execute(const string &sql);
+	void disable_referential_integrity() {}
+	void enable_referential_integrity() {}
+	void analyze_table(const Table &table) { execute("ANALYZE " + table.name); }
+	string export_snapshot() { return "memory"; }
+	void import_snapshot(const string &) {}
+	void unhold_snapshot() {}
+	void start_read_transaction() {}
+	void start_write_transaction() {}
+	void commit_transaction() {}
+	void rollback_transaction() {}
+	void populate_database_schema(Database &database);
+	void convert_unsupported_database_schema(Database &) {}
+	string escape_value(const string &value);
+	string escape_column_value(const Column &column, const string &value);
+	void append_escaped_value_to(string &result, const char *value, size_t length);
+	void append_escaped_column_value_to(string &result, const Column &column, const char *value, size_t length);
+	string column_type(const Column &column);
+	string column_sequence_name(const Table &table, const Column &column);
+	string column_default(const Table &table, const Column &column);
+	string column_definition(const Table &table, const Column &column);
+
+	inline char quote_identifiers_with() const { return '"'; }
+	inline string parameter_placeholder(size_t parameter_number) const { return "$" + to_string(parameter_number); }
+	inline string binary_collated(const string &expression) const { return expression; } // keys are always compared by their bytes
+
+protected:
+	const vector<PackedRow> &rows_of(const Table &table);
+	void range(const Table &table, const vector<PackedRow> &rows, const ColumnValues &prev_key, const ColumnValues &last_key, vector<PackedRow>::const_iterator &begin, vector<PackedRow>::const_iterator &end);
+
+private:
+	MemoryDatabase &database;
+
+	// forbid copying
+	MemoryClient(const MemoryClient& copy_from): database(copy_from.database) { throw logic_error("copying forbidden"); }
+};
+
+#endif
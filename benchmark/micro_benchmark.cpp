@@ -0,0 +1,202 @@
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <getopt.h>
+
+#include "memory_client.h"
+#include "../src/sync_algorithm.h"
+#include "../src/table_row_applier.h"
+
+// times the inner loops that the endpoints spend most of their time in, on fixed generated data, so that the effect
+// of changes to them can be seen without the noise of a whole sync.  each case is run several times and the median
+// reported, which is much more repeatable than a single run.
+
+struct BufferWriteStream {
+	inline void write(const uint8_t *src, size_t bytes) { buf.insert(buf.end(), src, src + bytes); }
+	inline void flush() {}
+
+	vector<uint8_t> buf;
+};
+
+struct BufferReadStream {
+	BufferReadStream(const vector<uint8_t> &buf): buf(buf), pos(0) {}
+
+	inline void read(uint8_t *dest, size_t bytes) {
+		if (pos + bytes > buf.size()) throw runtime_error("Read past the end of the buffer");
+		memcpy(dest, buf.data() + pos, bytes);
+		pos += bytes;
+	}
+
+	const vector<uint8_t> &buf;
+	size_t pos;
+};
+
+struct MicroBenchmarkOptions {
+	MicroBenchmarkOptions(): rows(100000), repeat(7), seed(1) {}
+
+	size_t rows;
+	size_t repeat;
+	unsigned int seed;
+};
+
+// runs the function the given number of times after a warm-up run, and reports the median time per item, and the
+// throughput if the number of bytes processed is given
+void benchmark(const MicroBenchmarkOptions &options, const string &name, size_t items, size_t bytes, const function<void()> &run) {
+	run();
+
+	vector<double> times;
+	for (size_t n = 0; n < options.repeat; n++) {
+		chrono::steady_clock::time_point started(chrono::steady_clock::now());
+		run();
+		times.push_back(seconds_since(started));
+	}
+	sort(times.begin(), times.end());
+	double median = times[times.size()/2];
+
+	cout << left << setw(34) << name << right << fixed << setprecision(1) << setw(12) << median*1e9/items << " ns/item";
+	if (bytes) cout << setw(12) << bytes/median/1024/1024 << " MB/s";
+	cout << endl;
+}
+
+Table micro_benchmark_table() {
+	Table table("micro");
+	table.columns.push_back(Column("id", false, DefaultType::no_default, "", ColumnTypes::SINT, 8));
+	table.columns.push_back(Column("amount", true, DefaultType::no_default, "", ColumnTypes::SINT, 4));
+	table.columns.push_back(Column("name", true, DefaultType::no_default, "", ColumnTypes::VCHR, 100));
+	table.columns.push_back(Column("notes", true, DefaultType::no_default, "", ColumnTypes::TEXT));
+	table.primary_key_columns.push_back(0);
+	return table;
+}
+
+string random_string(mt19937 &random, size_t min_length, size_t max_length) {
+	static const char characters[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 '";
+	string result(min_length + random() % (max_length - min_length + 1), ' ');
+	for (char &c : result) c = characters[random() % (sizeof(characters) - 1)];
+	return result;
+}
+
+int64_t random_integer(mt19937 &random) {
+	// a mix of the different integer encodings, weighted towards the smaller ones as real data usually is
+	switch (random() % 4) {
+		case 0:  return random() % 128;
+		case 1:  return (int64_t)(random() % 65536) - 32768;
+		case 2:  return (int64_t)random();
+		default: return ((int64_t)random() << 32) | random();
+	}
+}
+
+int main(int argc, char *argv[]) {
+	MicroBenchmarkOptions options;
+	static struct option longopts[] = {
+		{ "rows",	required_argument,	NULL,	'r' },
+		{ "repeat",	required_argument,	NULL,	'n' },
+		{ "seed",	required_argument,	NULL,	's' },
+		{ NULL,		0,					NULL,	0 },
+	};
+	while (true) {
+		int ch = getopt_long_only(argc, argv, "", longopts, NULL);
+		if (ch == -1) break;
+		switch (ch) {
+			case 'r': options.rows = max<size_t>(strtoull(optarg, NULL, 10), 1); break;
+			case 'n': options.repeat = max<size_t>(strtoull(optarg, NULL, 10), 1); break;
+			case 's': options.seed = atoi(optarg); break;
+			default:
+				cerr << "Usage: ks_micro_benchmark [--rows N] [--repeat N] [--seed N]\n";
+				return 1;
+		}
+	}
+
+	// generate the same data each time, so that runs can be compared
+	mt19937 random(options.seed);
+	Table table(micro_benchmark_table());
+	vector<int64_t> integers;
+	vector<string> strings;
+	vector<PackedRow> rows;
+	size_t string_bytes = 0;
+	for (size_t n = 0; n < options.rows; n++) {
+		integers.push_back(random_integer(random));
+		strings.push_back(random_string(random, 10, 80));
+		string_bytes += strings.back().size();
+
+		PackedRow row;
+		row << (int64_t)(n + 1);
+		if (random() % 10) row << (int32_t)random(); else row << nullptr;
+		row << random_string(random, 10, 40);
+		row << random_string(random, 0, 200);
+		rows.push_back(row);
+	}
+
+	// the rows as they'd arrive from the other end
+	BufferWriteStream packed_rows;
+	Packer<BufferWriteStream> row_packer(packed_rows);
+	for (const PackedRow &row : rows) row_packer << row;
+
+	MemoryDatabase database("micro");
+	MemoryClient client("", "", "micro", "", "");
+
+	cout << options.rows << " items, median of " << options.repeat << " runs" << endl << endl;
+
+	benchmark(options, "Packer integers", options.rows, 0, [&]() {
+		BufferWriteStream stream;
+		Packer<BufferWriteStream> packer(stream);
+		for (int64_t value : integers) packer << value;
+	});
+
+	benchmark(options, "Packer strings", options.rows, string_bytes, [&]() {
+		BufferWriteStream stream;
+		Packer<BufferWriteStream> packer(stream);
+		for (const string &value : strings) packer << value;
+	});
+
+	benchmark(options, "Unpacker rows into PackedRow", options.rows, packed_rows.buf.size(), [&]() {
+		BufferReadStream stream(packed_rows.buf);
+		Unpacker<BufferReadStream> unpacker(stream);
+		PackedRow row;
+		for (size_t n = 0; n < options.rows; n++) unpacker >> row;
+	});
+
+	benchmark(options, "RowHasher", options.rows, packed_rows.buf.size(), [&]() {
+		RowHasher hasher;
+		for (const PackedRow &row : rows) hasher(MemoryRow(row));
+		hasher.finish();
+	});
+
+	benchmark(options, "encode() values", options.rows*table.columns.size(), 0, [&]() {
+		string result;
+		for (const PackedRow &row : rows) {
+			for (size_t n = 0; n < row.size(); n++) {
+				result = encode(client, table.columns[n], row[n]);
+			}
+		}
+	});
+
+	benchmark(options, "append_row_tuple", options.rows, 0, [&]() {
+		BaseSQL sql("INSERT INTO micro VALUES\n(", ")");
+		for (const PackedRow &row : rows) {
+			append_row_tuple(client, table.columns, sql, row);
+			if (sql.curr.size() > BaseSQL::MAX_SENSIBLE_INSERT_COMMAND_SIZE) sql.reset();
+		}
+	});
+
+	benchmark(options, "RowLoader map insertion", options.rows, 0, [&]() {
+		RowsByPrimaryKey existing_rows;
+		RowLoader<MemoryClient> row_loader(table, existing_rows);
+		for (const PackedRow &row : rows) row_loader(MemoryRow(row));
+	});
+
+	RowsByPrimaryKey existing_rows;
+	RowLoader<MemoryClient> row_loader(table, existing_rows);
+	for (const PackedRow &row : rows) row_loader(MemoryRow(row));
+	benchmark(options, "PackedRow comparison and lookup", options.rows, 0, [&]() {
+		size_t matched = 0;
+		for (const PackedRow &row : rows) {
+			RowsByPrimaryKey::const_iterator existing_row = existing_rows.find(primary_key(table, row));
+			if (existing_row != existing_rows.end() && existing_row->second == row) matched++;
+		}
+		if (matched != rows.size()) throw logic_error("Rows didn't match");
+	});
+
+	return 0;
+}
@@ -0,0 +1,323 @@
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <deque>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/socket.h>
+
+#include "../src/sync_from.h"
+#include "../src/sync_to.h"
+#include "memory_client.h"
+
+// runs the real 'from' and 'to' workers against in-memory tables, connected over socketpairs, so that changes to the
+// synchronization algorithm can be measured without database servers.  the link between them can be given latency
+// and limited bandwidth, since the number of round trips matters much more on a real network than on a socketpair.
+
+struct BenchmarkOptions {
+	BenchmarkOptions(): rows(100000), workers(1), latency_ms(0), bandwidth_mbit(0), seed(1) {}
+
+	size_t rows;
+	int workers;
+	double latency_ms;
+	double bandwidth_mbit;
+	unsigned int seed;
+	string pattern;
+};
+
+// relays data from one descriptor to another, delivering each chunk after the given latency and no faster than the
+// given bandwidth (if non-zero), like a network link would
+struct SimulatedLink {
+	SimulatedLink(int read_fd, int write_fd, double latency_ms, double bandwidth_mbit):
+		read_fd(read_fd),
+		write_fd(write_fd),
+		latency(chrono::microseconds((int64_t)(latency_ms*1000))),
+		bytes_per_second(bandwidth_mbit*1000*1000/8),
+		finished(false),
+		receiver(&SimulatedLink::receive, this),
+		transmitter(&SimulatedLink::transmit, this) {
+	}
+
+	~SimulatedLink() {
+		receiver.join();
+		transmitter.join();
+		::close(read_fd);
+	}
+
+	void receive() {
+		while (true) {
+			Chunk chunk;
+			chunk.data.resize(65536);
+			ssize_t bytes = ::read(read_fd, &chunk.data[0], chunk.data.size());
+			if (bytes < 0 && errno == EINTR) continue;
+
+			std::unique_lock<std::mutex> lock(mutex);
+			if (bytes <= 0) {
+				finished = true;
+				cond.notify_all();
+				return;
+			}
+			chunk.data.resize(bytes);
+			chunk.received = chrono::steady_clock::now();
+			chunks.push_back(std::move(chunk));
+			cond.notify_all();
+		}
+	}
+
+	void transmit() {
+		chrono::steady_clock::time_point link_free;
+		while (true) {
+			Chunk chunk;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				while (chunks.empty() && !finished) cond.wait(lock);
+				if (chunks.empty()) break;
+				chunk = std::move(chunks.front());
+				chunks.pop_front();
+			}
+
+			// the link can only carry one chunk at a time, and each then takes the latency to arrive
+			chrono::steady_clock::time_point departs(max(chunk.received, link_free));
+			if (bytes_per_second) {
+				link_free = departs + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(chunk.data.size()/bytes_per_second));
+			} else {
+				link_free = departs;
+			}
+			this_thread::sleep_until(link_free + latency);
+
+			const uint8_t *ptr = chunk.data.data();
+			size_t bytes = chunk.data.size();
+			while (bytes > 0) {
+				ssize_t written = ::write(write_fd, ptr, bytes);
+				if (written < 0 && errno == EINTR) continue;
+				if (written <= 0) {
+					// the other end has gone away; keep reading so that the sender doesn't block
+					bytes = 0;
+					break;
+				}
+				ptr += written;
+				bytes -= written;
+			}
+		}
+		::close(write_fd);
+	}
+
+	struct Chunk {
+		vector<uint8_t> data;
+		chrono::steady_clock::time_point received;
+	};
+
+	int read_fd, write_fd;
+	chrono::steady_clock::duration latency;
+	double bytes_per_second;
+	deque<Chunk> chunks;
+	bool finished;
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::thread receiver;
+	std::thread transmitter;
+};
+
+// connects one end's output to the other end's input, returning the descriptor each should use
+void connect_endpoints(const BenchmarkOptions &options, int &write_fd, int &read_fd, vector<SimulatedLink*> &links) {
+	int first[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, first) < 0) throw runtime_error("Couldn't create socketpair: " + string(strerror(errno)));
+
+	if (!options.latency_ms && !options.bandwidth_mbit) {
+		write_fd = first[0];
+		read_fd = first[1];
+		return;
+	}
+
+	int second[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, second) < 0) throw runtime_error("Couldn't create socketpair: " + string(strerror(errno)));
+	write_fd = first[0];
+	read_fd = second[1];
+	links.push_back(new SimulatedLink(first[1], second[0], options.latency_ms, options.bandwidth_mbit));
+}
+
+Table benchmark_table() {
+	Table table("bench");
+	table.columns.push_back(Column("id", false, DefaultType::no_default, "", ColumnTypes::SINT, 8));
+	table.columns.push_back(Column("uniq", false, DefaultType::no_default, "", ColumnTypes::SINT, 8));
+	table.columns.push_back(Column("payload", true, DefaultType::no_default, "", ColumnTypes::VCHR, 100));
+	table.primary_key_columns.push_back(0);
+	Key key("bench_uniq", true);
+	key.columns.push_back(1);
+	table.keys.push_back(key);
+	return table;
+}
+
+string random_payload(mt19937 &random) {
+	static const char characters[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+	string payload(40 + random() % 40, ' ');
+	for (char &c : payload) c = characters[random() % (sizeof(characters) - 1)];
+	return payload;
+}
+
+PackedRow benchmark_row(int64_t id, int64_t uniq, const string &payload) {
+	PackedRow row;
+	row << id;
+	row << uniq;
+	row << payload;
+	return row;
+}
+
+// fills the 'to' table, and the 'from' table with the named differences from it
+void generate_pattern(const string &pattern, const BenchmarkOptions &options, MemoryTable &from, MemoryTable &to) {
+	mt19937 random(options.seed);
+	size_t changes = max<size_t>(options.rows/1000, 1);
+	size_t range = max<size_t>(options.rows/100, 1);
+
+	for (size_t id = 1; id <= options.rows; id++) {
+		to.rows.push_back(benchmark_row(id, id, random_payload(random)));
+	}
+	from.rows = to.rows;
+
+	if (pattern == "identical") {
+		// nothing to change
+
+	} else if (pattern == "updates") {
+		for (size_t n = 0; n < changes; n++) {
+			PackedValue &payload(from.rows[random() % from.rows.size()][2]);
+			payload.clear();
+			payload << random_payload(random);
+		}
+
+	} else if (pattern == "appended") {
+		to.rows.resize(to.rows.size() - range);
+
+	} else if (pattern == "deleted-range") {
+		size_t start = from.rows.size()/2;
+		from.rows.erase(from.rows.begin() + start, from.rows.begin() + start + range);
+
+	} else if (pattern == "shuffled-unique") {
+		// swap the unique key values between pairs of rows, so that they can't be updated in place
+		for (size_t n = 0; n < changes; n++) {
+			swap(from.rows[random() % from.rows.size()][1], from.rows[random() % from.rows.size()][1]);
+		}
+
+	} else {
+		throw runtime_error("Unknown pattern " + pattern);
+	}
+}
+
+struct BenchmarkResult {
+	BenchmarkResult(): seconds(0), statements(0), statement_bytes(0) {}
+
+	double seconds;
+	SyncMetrics totals;
+	size_t statements;
+	size_t statement_bytes;
+};
+
+void run_from(int read_fd, int write_fd) {
+	char status_area[256] = "";
+	try {
+		SyncFromWorker<MemoryClient> worker("", "", "from", "", "", "", "", read_fd, write_fd, status_area, sizeof(status_area));
+		worker();
+	} catch (const exception &e) {
+		// the 'to' end reports the error
+	}
+}
+
+BenchmarkResult run_pattern(const string &pattern, const BenchmarkOptions &options) {
+	MemoryDatabase from_database("from"), to_database("to");
+	Table table(benchmark_table());
+	generate_pattern(pattern, options, from_database.add_table(table), to_database.add_table(table));
+
+	Database database;
+	SyncQueue sync_queue(options.workers);
+	SyncProgress progress(options.workers);
+	vector<SimulatedLink*> links;
+	vector<thread> from_threads;
+	vector<SyncToWorker<MemoryClient>*> workers;
+
+	chrono::steady_clock::time_point started(chrono::steady_clock::now());
+	for (int worker = 0; worker < options.workers; worker++) {
+		int to_write_fd, from_read_fd, from_write_fd, to_read_fd;
+		connect_endpoints(options, to_write_fd, from_read_fd, links);
+		connect_endpoints(options, from_write_fd, to_read_fd, links);
+		from_threads.push_back(thread(run_from, from_read_fd, from_write_fd));
+		workers.push_back(new SyncToWorker<MemoryClient>(database, sync_queue, progress, worker, to_read_fd, to_write_fd, "", "", "to", "", "", "", set<string>(), set<string>(), 0, false, false, CommitLevel::success, false, false, SyncThresholds(), true));
+	}
+
+	BenchmarkResult result;
+	for (SyncToWorker<MemoryClient>* worker : workers) {
+		worker->worker_thread.join();
+		result.totals += worker->metrics.totals;
+		delete worker;
+	}
+	for (thread &from_thread : from_threads) from_thread.join();
+	result.seconds = seconds_since(started);
+	for (SimulatedLink *link : links) delete link;
+
+	if (sync_queue.aborted) throw runtime_error("Synchronization of pattern " + pattern + " failed");
+	result.statements = to_database.statements_executed;
+	result.statement_bytes = to_database.statement_bytes;
+	return result;
+}
+
+void usage() {
+	cerr << "Usage: ks_protocol_benchmark [--rows N] [--workers N] [--latency MS] [--bandwidth MBIT] [--seed N] [--pattern NAME]\n"
+			"Patterns: identical, updates, appended, deleted-range, shuffled-unique (default: all)\n";
+}
+
+bool parse_options(int argc, char *argv[], BenchmarkOptions &options) {
+	static struct option longopts[] = {
+		{ "rows",		required_argument,	NULL,	'r' },
+		{ "workers",	required_argument,	NULL,	'w' },
+		{ "latency",	required_argument,	NULL,	'l' },
+		{ "bandwidth",	required_argument,	NULL,	'b' },
+		{ "seed",		required_argument,	NULL,	's' },
+		{ "pattern",	required_argument,	NULL,	'p' },
+		{ NULL,			0,					NULL,	0 },
+	};
+
+	while (true) {
+		int ch = getopt_long_only(argc, argv, "", longopts, NULL);
+		if (ch == -1) return true;
+
+		switch (ch) {
+			case 'r': options.rows = strtoull(optarg, NULL, 10); break;
+			case 'w': options.workers = max(atoi(optarg), 1); break;
+			case 'l': options.latency_ms = atof(optarg); break;
+			case 'b': options.bandwidth_mbit = atof(optarg); break;
+			case 's': options.seed = atoi(optarg); break;
+			case 'p': options.pattern = optarg; break;
+			default: usage(); return false;
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
+	BenchmarkOptions options;
+	if (!parse_options(argc, argv, options)) return 1;
+
+	// the simulated links may still be writing to an endpoint when it finishes
+	signal(SIGPIPE, SIG_IGN);
+
+	vector<string> patterns{"identical", "updates", "appended", "deleted-range", "shuffled-unique"};
+	if (!options.pattern.empty()) patterns = vector<string>{options.pattern};
+
+	cout << options.rows << " rows, " << options.workers << " worker(s), " << options.latency_ms << "ms latency, ";
+	if (options.bandwidth_mbit) cout << options.bandwidth_mbit << "Mbit/s"; else cout << "unlimited bandwidth";
+	cout << endl << endl;
+
+	cout << left << setw(17) << "pattern" << right << setw(10) << "seconds" << setw(12) << "round trips" << setw(12) << "bytes sent" << setw(14) << "bytes recvd"
+		 << setw(10) << "inserted" << setw(10) << "updated" << setw(10) << "deleted" << setw(12) << "statements" << endl;
+
+	try {
+		for (const string &pattern : patterns) {
+			BenchmarkResult result(run_pattern(pattern, options));
+			cout << left << setw(17) << pattern << right << setw(10) << fixed << setprecision(3) << result.seconds << setw(12) << result.totals.round_trips
+				 << setw(12) << result.totals.bytes_sent << setw(14) << result.totals.bytes_received
+				 << setw(10) << result.totals.rows_inserted << setw(10) << result.totals.rows_updated << setw(10) << result.totals.rows_deleted
+				 << setw(12) << result.statements << endl;
+		}
+	} catch (const exception &e) {
+		cerr << e.what() << endl;
+		return 2;
+	}
+	return 0;
+}
@@ -1,6 +1,8 @@
 #include "abortable_barrier.h"
+#include "trace.h"
 
 bool AbortableBarrier::wait_at_barrier() {
+	TraceScope trace("sync", "barrier");
 	std::unique_lock<std::mutex> lock(mutex);
 	if (aborted) throw aborted_error();
 
@@ -0,0 +1,95 @@
+#include "apply_queue.h"
+#include "trace.h"
+
+ApplyQueue::ApplyQueue(size_t max_queued_bytes): max_queued_bytes(max_queued_bytes), queued_bytes(0), busy(false), stopping(false), applier_thread(&ApplyQueue::run, this) {
+}
+
+ApplyQueue::~ApplyQueue() {
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		stopping = true;
+		jobs.clear();
+		cond.notify_all();
+	}
+	applier_thread.join();
+}
+
+void ApplyQueue::push(function<void()> &&job, size_t bytes) {
+	std::unique_lock<std::mutex> lock(mutex);
+
+	// always let one job through, even if it's bigger than the limit on its own
+	while (!error && !jobs.empty() && queued_bytes + bytes > max_queued_bytes) {
+		cond.wait(lock);
+	}
+	rethrow_error();
+
+	jobs.emplace_back(std::move(job), bytes);
+	queued_bytes += bytes;
+	cond.notify_all();
+}
+
+void ApplyQueue::wait_until_idle() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!error && (busy || !jobs.empty())) {
+		cond.wait(lock);
+	}
+	rethrow_error();
+}
+
+void ApplyQueue::discard() {
+	// used when we're aborting; throws away any jobs that haven't started, and waits for the current job to finish
+	// (or fail) so that it doesn't outlive the objects it uses
+	std::unique_lock<std::mutex> lock(mutex);
+	jobs.clear();
+	queued_bytes = 0;
+	while (busy) {
+		cond.wait(lock);
+	}
+	error = exception_ptr();
+}
+
+void ApplyQueue::rethrow_error() {
+	if (error) {
+		// report the error only once; the caller will abort anyway
+		exception_ptr raise(error);
+		error = exception_ptr();
+		rethrow_exception(raise);
+	}
+}
+
+void ApplyQueue::run() {
+	Trace::name_thread("applier");
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (true) {
+		while (!stopping && jobs.empty()) {
+			cond.wait(lock);
+		}
+		if (stopping) return;
+
+		function<void()> job(std::move(jobs.front().first));
+		size_t bytes = jobs.front().second;
+		jobs.pop_front();
+		busy = true;
+		lock.unlock();
+
+		exception_ptr job_error;
+		try {
+			TraceScope trace("apply", "apply");
+			job();
+		} catch (...) {
+			job_error = current_exception();
+		}
+
+		lock.lock();
+		busy = false;
+		queued_bytes -= bytes;
+		if (job_error) {
+			// the remaining jobs depend on this one, so drop them and hand the error back to the worker
+			error = job_error;
+			jobs.clear();
+			queued_bytes = 0;
+		}
+		cond.notify_all();
+	}
+}
@@ -0,0 +1,40 @@
+#ifndef APPLY_QUEUE_H
+#define APPLY_QUEUE_H
+
+#include <deque>
+#include <functional>
+#include <exception>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+// runs jobs in order on a background thread.  used to apply changes to the database while the worker carries on
+// reading the next rows from the network; the total size of the queued jobs is bounded, so that we block rather
+// than bloat up if the database can't keep up with the other end.  if a job fails, the error is raised by the next
+// call to push() or wait_until_idle(); the destructor and discard() never throw, so they're safe to use when aborting.
+struct ApplyQueue {
+	ApplyQueue(size_t max_queued_bytes);
+	~ApplyQueue();
+
+	void push(function<void()> &&job, size_t bytes);
+	void wait_until_idle();
+	void discard();
+
+protected:
+	void run();
+	void rethrow_error();
+
+	size_t max_queued_bytes;
+	size_t queued_bytes;
+	deque< pair<function<void()>, size_t> > jobs;
+	bool busy;
+	bool stopping;
+	exception_ptr error;
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::thread applier_thread;
+};
+
+#endif
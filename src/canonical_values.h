@@ -0,0 +1,109 @@
+#ifndef CANONICAL_VALUES_H
+#define CANONICAL_VALUES_H
+
+#include <cfloat>
+#include <cstdio>
+#include <cstdlib>
+
+#include "schema.h"
+#include "encode_packed.h"
+
+// the databases return some types of values formatted differently: mysql pads fractional seconds and decimals
+// with zeros to the column's scale while postgresql trims them, postgresql pads fixed-length strings with spaces
+// while mysql strips them, and they print floating point numbers differently.  in syncs between different
+// databases the hashes of identical rows would then never match, so from protocol version 8 both ends hash the
+// values of these types in a canonical form.  the rows themselves are still sent as the database returned them.
+enum CanonicalForm {
+	as_returned = 0,
+	single_precision = 1,
+	double_precision = 2,
+	trailing_zeros_trimmed = 3,
+	trailing_spaces_trimmed = 4,
+};
+
+typedef vector<CanonicalForm> CanonicalForms;
+
+// returns an empty list if none of the columns need converting, so the rows can be hashed exactly as they are
+inline CanonicalForms canonical_forms_of(const Columns &columns) {
+	CanonicalForms result;
+	bool any_converted = false;
+
+	for (const Column &column : columns) {
+		CanonicalForm form(as_returned);
+		if (column.column_type == ColumnTypes::REAL) {
+			form = (column.size == 4 ? single_precision : double_precision);
+		} else if (column.column_type == ColumnTypes::DECI || column.column_type == ColumnTypes::TIME || column.column_type == ColumnTypes::DTTM) {
+			form = trailing_zeros_trimmed;
+		} else if (column.column_type == ColumnTypes::FCHR) {
+			form = trailing_spaces_trimmed;
+		}
+		any_converted = any_converted || form != as_returned;
+		result.push_back(form);
+	}
+
+	if (!any_converted) result.clear();
+	return result;
+}
+
+template <typename Packer>
+void pack_canonical_value(Packer &packer, CanonicalForm form, const PackedValue &value) {
+	uint8_t leader = value.leader();
+	bool raw = (leader >= MSGPACK_FIXRAW_MIN && leader <= MSGPACK_FIXRAW_MAX) || leader == MSGPACK_RAW16 || leader == MSGPACK_RAW32;
+	if (form == as_returned || !raw) {
+		packer << value;
+		return;
+	}
+
+	size_t length;
+	const char *data = packed_string_data(value, length);
+
+	switch (form) {
+		case single_precision:
+			// mysql prints floats to about 6 significant digits while postgresql prints the shortest exact value, so
+			// they don't parse to the same float; round to the digits that both can represent before hashing
+			{
+				char rounded[32];
+				snprintf(rounded, sizeof(rounded), "%.*g", FLT_DIG, strtof(string(data, length).c_str(), nullptr));
+				packer << strtod(rounded, nullptr);
+			}
+			break;
+
+		case double_precision:
+			packer << strtod(string(data, length).c_str(), nullptr);
+			break;
+
+		case trailing_zeros_trimmed:
+			if (memchr(data, '.', length)) {
+				while (data[length - 1] == '0') length--;
+				if (data[length - 1] == '.') length--;
+			}
+			packer << memory(data, length);
+			break;
+
+		case trailing_spaces_trimmed:
+			while (length > 0 && data[length - 1] == ' ') length--;
+			packer << memory(data, length);
+			break;
+
+		default:
+			packer << value;
+	}
+}
+
+template <typename Packer, typename DatabaseRow>
+void pack_canonical_row_into(Packer &packer, const DatabaseRow &row, const CanonicalForms &forms) {
+	pack_array_length(packer, row.n_columns());
+
+	PackedValue value;
+	for (size_t column_number = 0; column_number < (size_t)row.n_columns(); column_number++) {
+		if (column_number < forms.size() && forms[column_number] != as_returned) {
+			value.clear();
+			row.pack_column_into(value, column_number);
+			pack_canonical_value(packer, forms[column_number], value);
+		} else {
+			row.pack_column_into(packer, column_number);
+		}
+	}
+}
+
+#endif
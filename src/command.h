@@ -4,6 +4,7 @@
 #include <stdexcept>
 #include "message_pack/pack.h"
 #include "message_pack/unpack.h"
+#include "trace.h"
 
 using namespace std;
 
@@ -13,6 +14,8 @@ struct command_error: public runtime_error {
 
 typedef uint32_t verb_t;
 
+inline const char *command_name(verb_t verb);
+
 template <typename InputStream>
 inline void read_values(Unpacker<InputStream> &unpacker) {
 	/* do nothing, this specialization is just to terminate the variadic template expansion */
@@ -46,6 +49,7 @@ inline void read_expected_command(Unpacker<InputStream> &unpacker, verb_t expect
 	verb_t verb;
 	unpacker >> verb;
 	if (verb != expected_verb) throw command_error("Expected verb " + to_string(expected_verb) + " but received " + to_string(verb));
+	if (Trace::enabled()) Trace::instant("receive", command_name(verb));
 	read_all_arguments(unpacker, args...);
 }
 
@@ -68,6 +72,7 @@ inline void send_array(Packer<OutputStream> &packer, const Values &...args) {
 
 template <typename OutputStream, typename... Values>
 inline void send_command_begin(Packer<OutputStream> &packer, verb_t verb, const Values &...args) {
+	if (Trace::enabled()) Trace::instant("send", command_name(verb));
 	packer << verb;
 	send_array(packer, args...);
 }
@@ -95,6 +100,8 @@ namespace Commands {
 	const verb_t HASH_FAIL = 4;
 	const verb_t ROWS_AND_HASH_NEXT = 5;
 	const verb_t ROWS_AND_HASH_FAIL = 6;
+	const verb_t SELECT_TABLE = 7;
+	const verb_t END_KEY = 8;
 
 	const verb_t PROTOCOL = 32;
 	const verb_t EXPORT_SNAPSHOT  = 33;
@@ -103,7 +110,31 @@ namespace Commands {
 	const verb_t WITHOUT_SNAPSHOT = 36;
 	const verb_t SCHEMA = 37;
 	const verb_t TARGET_BLOCK_SIZE = 38;
+	const verb_t BINARY_KEY_ORDER = 39;
 	const verb_t QUIT = 0;
 };
 
+inline const char *command_name(verb_t verb) {
+	switch (verb) {
+		case Commands::OPEN:               return "OPEN";
+		case Commands::ROWS:               return "ROWS";
+		case Commands::HASH_NEXT:          return "HASH_NEXT";
+		case Commands::HASH_FAIL:          return "HASH_FAIL";
+		case Commands::ROWS_AND_HASH_NEXT: return "ROWS_AND_HASH_NEXT";
+		case Commands::ROWS_AND_HASH_FAIL: return "ROWS_AND_HASH_FAIL";
+		case Commands::SELECT_TABLE:       return "SELECT_TABLE";
+		case Commands::END_KEY:            return "END_KEY";
+		case Commands::PROTOCOL:           return "PROTOCOL";
+		case Commands::EXPORT_SNAPSHOT:    return "EXPORT_SNAPSHOT";
+		case Commands::IMPORT_SNAPSHOT:    return "IMPORT_SNAPSHOT";
+		case Commands::UNHOLD_SNAPSHOT:    return "UNHOLD_SNAPSHOT";
+		case Commands::WITHOUT_SNAPSHOT:   return "WITHOUT_SNAPSHOT";
+		case Commands::SCHEMA:             return "SCHEMA";
+		case Commands::TARGET_BLOCK_SIZE:  return "TARGET_BLOCK_SIZE";
+		case Commands::BINARY_KEY_ORDER:   return "BINARY_KEY_ORDER";
+		case Commands::QUIT:               return "QUIT";
+		default:                           return "unknown command";
+	}
+}
+
 #endif
@@ -19,4 +19,10 @@ struct SetNullability {
 struct SupportsAddNonNullableColumns {
 };
 
+struct TransactionalDDL {
+};
+
+struct SupportsCreateKeysConcurrently {
+};
+
 #endif
@@ -3,11 +3,68 @@
 
 #include "message_pack/copy_packed.h"
 
+// writes the decimal representation of an integer to the end of the string without any temporaries
+template <typename Integer>
+void append_integer(string &result, Integer value) {
+	char buffer[24];
+	char *end = buffer + sizeof(buffer);
+	char *start = end;
+	bool negative = (value < 0);
+	// work with the magnitude as an unsigned value, so that the most negative value doesn't overflow
+	uint64_t magnitude = negative ? (uint64_t)0 - (uint64_t)value : (uint64_t)value;
+	do {
+		*--start = '0' + magnitude % 10;
+		magnitude /= 10;
+	} while (magnitude);
+	if (negative) *--start = '-';
+	result.append(start, end - start);
+}
+
+// formats floating point values in the same way as to_string, but straight into the string
+inline void append_real(string &result, double value) {
+	char buffer[512]; // enough for "%f" of the largest double
+	int length = snprintf(buffer, sizeof(buffer), "%f", value);
+	result.append(buffer, length);
+}
+
+// returns the bytes of a packed string value, which must be a MessagePack raw type, without copying them
+inline const char *packed_string_data(const PackedValue &value, size_t &length) {
+	uint8_t leader = value.leader();
+	const uint8_t *data = value.data();
+
+	if (leader >= MSGPACK_FIXRAW_MIN && leader <= MSGPACK_FIXRAW_MAX) {
+		length = leader & 31;
+		return (const char *)data + 1;
+	}
+
+	switch (leader) {
+		case MSGPACK_RAW16: {
+			uint16_t network_order;
+			memcpy(&network_order, data + 1, sizeof(network_order));
+			length = ntohs(network_order);
+			return (const char *)data + 1 + sizeof(network_order);
+		}
+
+		case MSGPACK_RAW32: {
+			uint32_t network_order;
+			memcpy(&network_order, data + 1, sizeof(network_order));
+			length = ntohl(network_order);
+			return (const char *)data + 1 + sizeof(network_order);
+		}
+
+		default:
+			backtrace();
+			throw unpacker_error("Don't know how to convert MessagePack type " + to_string((int)leader) + " to string");
+	}
+}
+
+// appends the SQL literal for the value to the string.  this is used to build the big insert and delete statements
+// when applying changes, so it writes straight into the destination buffer rather than building strings for each value.
 template <typename DatabaseClient>
-string encode(DatabaseClient &client, const Column &column, const PackedValue &value) {
-	if (value.is_nil())		return "NULL";
-	if (value.is_false())	return "false";
-	if (value.is_true())	return "true";
+void append_encoded(DatabaseClient &client, string &result, const Column &column, const PackedValue &value) {
+	if (value.is_nil())		{ result += "NULL"; return; }
+	if (value.is_false())	{ result += "false"; return; }
+	if (value.is_true())	{ result += "true"; return; }
 
 	VectorReadStream stream(value);
 	Unpacker<VectorReadStream> unpacker(stream);
@@ -15,43 +72,66 @@ string encode(DatabaseClient &client, const Column &column, const PackedValue &v
 
 	if ((leader >= MSGPACK_POSITIVE_FIXNUM_MIN && leader <= MSGPACK_POSITIVE_FIXNUM_MAX) ||
 		(leader >= MSGPACK_NEGATIVE_FIXNUM_MIN && leader <= MSGPACK_NEGATIVE_FIXNUM_MAX)) {
-		return to_string((int)unpacker.template next<int8_t>()); // up-cast to avoid int8_t being interpreted as char
+		append_integer(result, (int)unpacker.template next<int8_t>()); // up-cast to avoid int8_t being interpreted as char
+		return;
 	}
 
 	switch (leader) {
 		case MSGPACK_FLOAT:
-			return to_string(unpacker.template next<float>());
+			append_real(result, unpacker.template next<float>());
+			break;
 
 		case MSGPACK_DOUBLE:
-			return to_string(unpacker.template next<double>());
+			append_real(result, unpacker.template next<double>());
+			break;
 
 		case MSGPACK_UINT8:
-			return to_string((unsigned int)unpacker.template next<uint8_t>()); // up-cast as above
+			append_integer(result, (unsigned int)unpacker.template next<uint8_t>()); // up-cast as above
+			break;
 
 		case MSGPACK_UINT16:
-			return to_string(unpacker.template next<uint16_t>());
+			append_integer(result, unpacker.template next<uint16_t>());
+			break;
 
 		case MSGPACK_UINT32:
-			return to_string(unpacker.template next<uint32_t>());
+			append_integer(result, unpacker.template next<uint32_t>());
+			break;
 
 		case MSGPACK_UINT64:
-			return to_string(unpacker.template next<uint64_t>());
+			append_integer(result, unpacker.template next<uint64_t>());
+			break;
 
 		case MSGPACK_INT8:
-			return to_string((int)unpacker.template next<int8_t>()); // up-cast as above
+			append_integer(result, (int)unpacker.template next<int8_t>()); // up-cast as above
+			break;
 
 		case MSGPACK_INT16:
-			return to_string(unpacker.template next<int16_t>());
+			append_integer(result, unpacker.template next<int16_t>());
+			break;
 
 		case MSGPACK_INT32:
-			return to_string(unpacker.template next<int32_t>());
+			append_integer(result, unpacker.template next<int32_t>());
+			break;
 
 		case MSGPACK_INT64:
-			return to_string(unpacker.template next<int64_t>());
-
-		default:
-			return "'" + client.escape_column_value(column, unpacker.template next<string>()) + "'";
+			append_integer(result, unpacker.template next<int64_t>());
+			break;
+
+		default: {
+			size_t length;
+			const char *data = packed_string_data(value, length);
+			result += '\'';
+			client.append_escaped_column_value_to(result, column, data, length);
+			result += '\'';
+		}
 	}
 }
 
+template <typename DatabaseClient>
+string encode(DatabaseClient &client, const Column &column, const PackedValue &value) {
+	string result;
+	append_encoded(client, result, column, value);
+	return result;
+}
+
 #endif
@@ -37,7 +37,13 @@ int endpoint_main(int argc, char *argv[]) {
 		
 		// the remaining arguments are different for the two arguments
 		if (from) {
-			const string filters_file = argc > 8 ? argv[8] : "";
+			string filters_file(argc > 8 ? argv[8] : "");
+			string trace_file(argc > 9 ? argv[9] : "");
+			if (filters_file == string("-")) filters_file = "";
+			if (trace_file   == string("-")) trace_file   = "";
+			// there's one 'from' process for each worker, and they may be on another host, so each writes its own file
+			if (!trace_file.empty()) trace_file += ".from-" + to_string(getpid());
+			TraceFile trace(trace_file, "ks from");
 			char *status_area = argv[1];
 			char *last_arg = argv[argc - 1];
 			char *end_of_last_arg = last_arg + strlen(last_arg);
@@ -52,7 +58,20 @@ int endpoint_main(int argc, char *argv[]) {
 			bool snapshot = argc > 13 ? atoi(argv[13]) : false;
 			bool alter = argc > 14 ? atoi(argv[14]) : true;
 			CommitLevel commit_level = argc > 15 ? CommitLevel(atoi(argv[15])) : CommitLevel::success;
-			sync_to<DatabaseClient>(workers, startfd, database_host, database_port, database_name, database_username, database_password, set_variables, ignore, only, verbose, snapshot, alter, commit_level);
+			bool apply_in_background = argc > 16 ? atoi(argv[16]) : false;
+			string metrics_file = argc > 17 ? argv[17] : "";
+			bool progress = argc > 18 ? atoi(argv[18]) : false;
+			string trace_file(argc > 19 ? argv[19] : "");
+			bool binary_key_order = argc > 20 ? atoi(argv[20]) : false;
+			// ks doesn't pass the thresholds; they're only given by the tests, to reach the code paths they switch to
+			SyncThresholds thresholds;
+			if (argc > 21 && *argv[21]) thresholds.defer_keys_after_rows_changed = strtoull(argv[21], nullptr, 10);
+			if (argc > 22 && *argv[22]) thresholds.delete_range_chunk_rows = strtoull(argv[22], nullptr, 10);
+			if (argc > 23 && *argv[23]) thresholds.minimum_rows_to_share = strtoull(argv[23], nullptr, 10);
+			if (argc > 24 && *argv[24]) thresholds.analyze_after_rows_changed = strtoull(argv[24], nullptr, 10);
+			if (trace_file == string("-")) trace_file = "";
+			TraceFile trace(trace_file, "ks to");
+			sync_to<DatabaseClient>(workers, startfd, metrics_file, progress, database_host, database_port, database_name, database_username, database_password, set_variables, ignore, only, verbose, snapshot, alter, commit_level, apply_in_background, binary_key_order, thresholds);
 		}
 	} catch (const sync_error& e) {
 		// the worker thread has already output the error to cerr
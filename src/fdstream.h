@@ -3,6 +3,9 @@
 
 #include <unistd.h>
 #include <stdexcept>
+#include <chrono>
+#include <stdint.h>
+#include "trace.h"
 
 struct stream_error: public std::runtime_error {
 	stream_error(const std::string &error): runtime_error(error) {}
@@ -13,7 +16,7 @@ struct stream_closed_error: public stream_error {
 };
 
 struct FDReadStream {
-	FDReadStream(int fd): fd(fd), buf_pos(0), buf_avail(0) {}
+	FDReadStream(int fd): fd(fd), buf_pos(0), buf_avail(0), bytes_read(0), read_wait(0) {}
 
 	~FDReadStream() {
 		close();
@@ -41,18 +44,24 @@ struct FDReadStream {
 
 protected:
 	void fill_buf() {
-		ssize_t bytes_read;
+		ssize_t bytes_received;
 		while (true) {
-			bytes_read = ::read(fd, buf, sizeof(buf));
-			if (bytes_read == 0) {
+			// keep track of how long we spend blocked waiting for the other end, which is the main thing we can't see
+			// from inside each endpoint
+			std::chrono::steady_clock::time_point started(std::chrono::steady_clock::now());
+			TraceScope trace("io", "read");
+			bytes_received = ::read(fd, buf, sizeof(buf));
+			read_wait += std::chrono::steady_clock::now() - started;
+			if (bytes_received == 0) {
 				throw stream_closed_error();
 			}
-			if (bytes_read < 0) {
+			if (bytes_received < 0) {
 				if (errno == EINTR) continue;
 				throw stream_error("Couldn't read from descriptor: " + string(strerror(errno)));
 			}
-			buf_avail = bytes_read;
+			buf_avail = bytes_received;
 			buf_pos = 0;
+			bytes_read += bytes_received;
 			break;
 		}
 	}
@@ -60,10 +69,14 @@ protected:
 	int fd;
 	size_t buf_pos, buf_avail;
 	uint8_t buf[16384];
+
+public:
+	uint64_t bytes_read;
+	std::chrono::steady_clock::duration read_wait;
 };
 
 struct FDWriteStream {
-	FDWriteStream(int fd): fd(fd), buf_used(0) {}
+	FDWriteStream(int fd): fd(fd), buf_used(0), bytes_written(0) {}
 	
 	~FDWriteStream() {
 		close();
@@ -95,27 +108,32 @@ struct FDWriteStream {
 
 	// forces any bytes currently in the buffer to the underlying descriptor
 	inline void flush() {
+		TraceScope trace("io", "flush");
 		write_buf(buf, buf_used);
 		buf_used = 0;
 	}
 
 protected:
 	void write_buf(const uint8_t* ptr, size_t bytes) {
-		ssize_t bytes_written;
+		ssize_t written;
 		while (bytes > 0) {
-			bytes_written = ::write(fd, ptr, bytes);
-			if (bytes_written <= 0) {
+			written = ::write(fd, ptr, bytes);
+			if (written <= 0) {
 				if (errno == EINTR) continue;
 				throw stream_error("Couldn't write to descriptor: " + string(strerror(errno)));
 			}
-			ptr   += bytes_written;
-			bytes -= bytes_written;
+			ptr   += written;
+			bytes -= written;
+			bytes_written += written;
 		}
 	}
 
 	int fd;
 	size_t buf_used;
 	uint8_t buf[16384];
+
+public:
+	uint64_t bytes_written;
 };
 
 #endif
@@ -0,0 +1,25 @@
+#ifndef JSON_STRING_H
+#define JSON_STRING_H
+
+#include <string>
+#include <ostream>
+#include <iomanip>
+
+using namespace std;
+
+// writes the value as a quoted JSON string, escaping quotes, backslashes and control characters
+inline void write_json_string(ostream &os, const string &value) {
+	os << '"';
+	for (unsigned char c : value) {
+		if (c == '"' || c == '\\') {
+			os << '\\' << c;
+		} else if (c < 0x20) {
+			os << "\\u" << hex << setw(4) << setfill('0') << (int)c << dec << setfill(' ');
+		} else {
+			os << c;
+		}
+	}
+	os << '"';
+}
+
+#endif
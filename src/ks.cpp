@@ -50,10 +50,12 @@ int main(int argc, char *argv[]) {
 		if (options.to  .password.empty()) options.to  .password = "-";
 		if (options.set_from_variables.empty()) options.set_from_variables = "-";
 		if (options.set_to_variables.empty())   options.set_to_variables = "-";
+		if (options.filters.empty()) options.filters = "-";
+		if (options.trace_file.empty()) options.trace_file = "-";
 
 		const char *from_args[] = { ssh_binary.c_str(), "-C", "-c", "blowfish", options.via.c_str(),
-									from_binary.c_str(), "from", options.from.host.c_str(), options.from.port.c_str(), options.from.database.c_str(), options.from.username.c_str(), options.from.password.c_str(), options.set_from_variables.c_str(), options.filters.c_str(), nullptr };
-		const char *  to_args[] = {   to_binary.c_str(),   "to",   options.to.host.c_str(),   options.to.port.c_str(),   options.to.database.c_str(),   options.to.username.c_str(),   options.to.password.c_str(), options.set_to_variables.c_str(), options.ignore.c_str(), options.only.c_str(), workers_str.c_str(), startfd_str.c_str(), verbose_str.c_str(), options.snapshot ? "1" : "0", options.alter ? "1" : "0", commit_str.c_str(), nullptr };
+									from_binary.c_str(), "from", options.from.host.c_str(), options.from.port.c_str(), options.from.database.c_str(), options.from.username.c_str(), options.from.password.c_str(), options.set_from_variables.c_str(), options.filters.c_str(), options.trace_file.c_str(), nullptr };
+		const char *  to_args[] = {   to_binary.c_str(),   "to",   options.to.host.c_str(),   options.to.port.c_str(),   options.to.database.c_str(),   options.to.username.c_str(),   options.to.password.c_str(), options.set_to_variables.c_str(), options.ignore.c_str(), options.only.c_str(), workers_str.c_str(), startfd_str.c_str(), verbose_str.c_str(), options.snapshot ? "1" : "0", options.alter ? "1" : "0", commit_str.c_str(), options.apply_in_background ? "1" : "0", options.metrics_file.c_str(), options.progress ? "1" : "0", options.trace_file.c_str(), options.from.protocol != options.to.protocol ? "1" : "0", nullptr };
 		const char **applicable_from_args = (options.via.empty() ? from_args + 5 : from_args);
 
 		if (options.verbose >= VERY_VERBOSE) {
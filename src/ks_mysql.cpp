@@ -2,13 +2,21 @@
 
 #include <stdexcept>
 #include <set>
+#include <memory>
 #include <mysql.h>
+#include <mysqld_error.h>
 
 #include "schema.h"
 #include "database_client_traits.h"
 #include "row_printer.h"
 
 #define MYSQL_5_6_5 50605
+#define MARIADB_10_2_7 100207
+
+// when we have to use FLUSH TABLES WITH READ LOCK, we give up waiting for it after this many seconds and try again a
+// little later, since while it waits for long-running queries to finish, it blocks all other updates
+const int SNAPSHOT_LOCK_WAIT_TIMEOUT = 5;
+const int SNAPSHOT_LOCK_ATTEMPTS = 6;
 
 class MySQLRes {
 public:
@@ -109,6 +117,431 @@ private:
 };
 
 
+// parameter values for prepared statements, bound using their native types rather than encoded as SQL literals
+class MySQLParams {
+public:
+	void add(const Column &column, const PackedValue &value);
+	void add(int64_t value);
+
+	inline size_t n_params() const { return params.size(); }
+	MYSQL_BIND *binds();
+
+private:
+	struct Param {
+		Param(enum_field_types type): type(type), is_unsigned(false), integer(0), real(0) {}
+
+		enum_field_types type;
+		bool is_unsigned;
+		int64_t integer;
+		double real;
+		string bytes;
+		unsigned long length;
+	};
+
+	vector<Param> params;
+	vector<MYSQL_BIND> _binds;
+};
+
+void MySQLParams::add(const Column &column, const PackedValue &value) {
+	if (value.is_nil()) {
+		params.emplace_back(MYSQL_TYPE_NULL);
+		return;
+	}
+
+	if (value.is_false() || value.is_true()) {
+		params.emplace_back(MYSQL_TYPE_LONGLONG);
+		params.back().integer = value.is_true();
+		return;
+	}
+
+	VectorReadStream stream(value);
+	Unpacker<VectorReadStream> unpacker(stream);
+	uint8_t leader = value.leader();
+
+	if ((leader >= MSGPACK_POSITIVE_FIXNUM_MIN && leader <= MSGPACK_POSITIVE_FIXNUM_MAX) ||
+		(leader >= MSGPACK_NEGATIVE_FIXNUM_MIN && leader <= MSGPACK_NEGATIVE_FIXNUM_MAX) ||
+		leader == MSGPACK_INT8 || leader == MSGPACK_INT16 || leader == MSGPACK_INT32 || leader == MSGPACK_INT64 ||
+		leader == MSGPACK_UINT8 || leader == MSGPACK_UINT16 || leader == MSGPACK_UINT32) {
+		params.emplace_back(MYSQL_TYPE_LONGLONG);
+		params.back().integer = unpacker.template next<int64_t>();
+		return;
+	}
+
+	switch (leader) {
+		case MSGPACK_UINT64:
+			params.emplace_back(MYSQL_TYPE_LONGLONG);
+			params.back().is_unsigned = true;
+			params.back().integer = (int64_t)unpacker.template next<uint64_t>();
+			break;
+
+		case MSGPACK_FLOAT:
+		case MSGPACK_DOUBLE:
+			params.emplace_back(MYSQL_TYPE_DOUBLE);
+			params.back().real = unpacker.template next<double>();
+			break;
+
+		default:
+			params.emplace_back(column.column_type == ColumnTypes::BLOB ? MYSQL_TYPE_BLOB : MYSQL_TYPE_STRING);
+			params.back().bytes = unpacker.template next<string>();
+			params.back().length = params.back().bytes.size();
+	}
+}
+
+void MySQLParams::add(int64_t value) {
+	params.emplace_back(MYSQL_TYPE_LONGLONG);
+	params.back().integer = value;
+}
+
+MYSQL_BIND *MySQLParams::binds() {
+	// the params may have moved as they were added, so we only take pointers to them once they're all present
+	_binds.resize(params.size());
+	memset(_binds.data(), 0, sizeof(MYSQL_BIND)*_binds.size());
+
+	for (size_t n = 0; n < params.size(); n++) {
+		Param &param(params[n]);
+		MYSQL_BIND &bind(_binds[n]);
+		bind.buffer_type = param.type;
+		bind.is_unsigned = param.is_unsigned;
+
+		switch (param.type) {
+			case MYSQL_TYPE_NULL:
+				break;
+
+			case MYSQL_TYPE_LONGLONG:
+				bind.buffer = &param.integer;
+				break;
+
+			case MYSQL_TYPE_DOUBLE:
+				bind.buffer = &param.real;
+				break;
+
+			default:
+				bind.buffer = (void *)param.bytes.data();
+				bind.buffer_length = param.length;
+				bind.length = &param.length;
+		}
+	}
+
+	return _binds.data();
+}
+
+class MySQLStatement {
+public:
+	MySQLStatement(MYSQL &mysql, const string &sql);
+	~MySQLStatement();
+
+	void execute(MySQLParams &params);
+	int64_t select_one_integer(MySQLParams &params);
+
+	inline MYSQL_STMT *stmt() { return _stmt; }
+	inline const string &sql() const { return _sql; }
+
+private:
+	void check(bool failed);
+
+	MYSQL_STMT *_stmt;
+	string _sql;
+
+	// forbid copying
+	MySQLStatement(const MySQLStatement& copy_from) { throw logic_error("copying forbidden"); }
+};
+
+MySQLStatement::MySQLStatement(MYSQL &mysql, const string &sql): _sql(sql) {
+	_stmt = mysql_stmt_init(&mysql);
+	if (!_stmt) throw runtime_error(mysql_error(&mysql) + string("\n") + sql);
+	check(mysql_stmt_prepare(_stmt, sql.c_str(), sql.length()));
+}
+
+MySQLStatement::~MySQLStatement() {
+	mysql_stmt_close(_stmt);
+}
+
+void MySQLStatement::check(bool failed) {
+	if (failed) {
+		backtrace();
+		throw runtime_error(mysql_stmt_error(_stmt) + string("\n") + _sql);
+	}
+}
+
+void MySQLStatement::execute(MySQLParams &params) {
+	if (params.n_params() != mysql_stmt_param_count(_stmt)) throw logic_error("Expected " + to_string(mysql_stmt_param_count(_stmt)) + " parameters, got " + to_string(params.n_params()) + "\n" + _sql);
+	check(mysql_stmt_bind_param(_stmt, params.binds()));
+	check(mysql_stmt_execute(_stmt));
+}
+
+int64_t MySQLStatement::select_one_integer(MySQLParams &params) {
+	execute(params);
+
+	int64_t result = 0;
+	MYSQL_BIND bind;
+	memset(&bind, 0, sizeof(bind));
+	bind.buffer_type = MYSQL_TYPE_LONGLONG;
+	bind.buffer = &result;
+	check(mysql_stmt_bind_result(_stmt, &bind));
+
+	int status = mysql_stmt_fetch(_stmt);
+	mysql_stmt_free_result(_stmt);
+	check(status == 1);
+	if (status == MYSQL_NO_DATA) throw runtime_error("Expected query to return one row\n" + _sql);
+
+	return result;
+}
+
+// the type libmysql uses for flags in MYSQL_BIND, which changed from my_bool to bool in 8.0
+typedef remove_pointer<decltype(MYSQL_BIND::is_null)>::type mysql_bind_flag;
+
+// reads the results of a prepared statement using the binary protocol.  integers are bound as native integers and
+// temporal values as MYSQL_TIME structs; everything else is bound as a string, growing the buffers as needed.
+class MySQLStatementRes {
+public:
+	MySQLStatementRes(MySQLStatement &statement);
+	~MySQLStatementRes();
+
+	bool fetch();
+
+	inline int n_columns() const { return columns.size(); }
+	inline enum_field_types type_of(int column_number) const { return columns[column_number].type; }
+	inline bool unsigned_at(int column_number) const { return columns[column_number].is_unsigned; }
+	inline unsigned int decimals_at(int column_number) const { return columns[column_number].decimals; }
+
+	inline bool null_at(int column_number) const { return columns[column_number].is_null; }
+	inline int64_t int_at(int column_number) const { return columns[column_number].integer; }
+	inline const MYSQL_TIME &time_at(int column_number) const { return columns[column_number].time; }
+	inline const void *result_at(int column_number) const { return columns[column_number].buffer.data(); }
+	inline unsigned long length_of(int column_number) const { return columns[column_number].length; }
+
+private:
+	struct Column {
+		enum_field_types type;
+		bool is_unsigned;
+		unsigned int decimals;
+		mysql_bind_flag is_null;
+		unsigned long length;
+		int64_t integer;
+		MYSQL_TIME time;
+		string buffer;
+	};
+
+	void bind_column(size_t column_number);
+
+	MySQLStatement &statement;
+	vector<Column> columns;
+	vector<MYSQL_BIND> binds;
+};
+
+MySQLStatementRes::MySQLStatementRes(MySQLStatement &statement): statement(statement) {
+	const size_t INITIAL_STRING_BUFFER_SIZE = 256;
+
+	MYSQL_RES *metadata = mysql_stmt_result_metadata(statement.stmt());
+	if (!metadata) throw runtime_error(mysql_stmt_error(statement.stmt()) + string("\n") + statement.sql());
+
+	columns.resize(mysql_num_fields(metadata));
+	binds.resize(columns.size());
+	memset(binds.data(), 0, sizeof(MYSQL_BIND)*binds.size());
+
+	MYSQL_FIELD *fields = mysql_fetch_fields(metadata);
+	for (size_t column_number = 0; column_number < columns.size(); column_number++) {
+		Column &column(columns[column_number]);
+		column.type = fields[column_number].type;
+		column.is_unsigned = fields[column_number].flags & UNSIGNED_FLAG;
+		column.decimals = fields[column_number].decimals;
+
+		switch (column.type) {
+			case MYSQL_TYPE_TINY:
+			case MYSQL_TYPE_SHORT:
+			case MYSQL_TYPE_INT24:
+			case MYSQL_TYPE_LONG:
+			case MYSQL_TYPE_LONGLONG:
+			case MYSQL_TYPE_YEAR:
+			case MYSQL_TYPE_DATE:
+			case MYSQL_TYPE_TIME:
+			case MYSQL_TYPE_DATETIME:
+			case MYSQL_TYPE_TIMESTAMP:
+				break;
+
+			default:
+				column.buffer.resize(INITIAL_STRING_BUFFER_SIZE);
+		}
+
+		bind_column(column_number);
+	}
+	mysql_free_result(metadata);
+
+	if (mysql_stmt_bind_result(statement.stmt(), binds.data())) {
+		throw runtime_error(mysql_stmt_error(statement.stmt()) + string("\n") + statement.sql());
+	}
+}
+
+MySQLStatementRes::~MySQLStatementRes() {
+	mysql_stmt_free_result(statement.stmt()); // discards any rows we haven't read
+}
+
+void MySQLStatementRes::bind_column(size_t column_number) {
+	Column &column(columns[column_number]);
+	MYSQL_BIND &bind(binds[column_number]);
+	bind.is_null = &column.is_null;
+	bind.length = &column.length;
+	bind.is_unsigned = column.is_unsigned;
+
+	switch (column.type) {
+		case MYSQL_TYPE_TINY:
+		case MYSQL_TYPE_SHORT:
+		case MYSQL_TYPE_INT24:
+		case MYSQL_TYPE_LONG:
+		case MYSQL_TYPE_LONGLONG:
+		case MYSQL_TYPE_YEAR:
+			bind.buffer_type = MYSQL_TYPE_LONGLONG;
+			bind.buffer = &column.integer;
+			break;
+
+		case MYSQL_TYPE_DATE:
+		case MYSQL_TYPE_TIME:
+		case MYSQL_TYPE_DATETIME:
+		case MYSQL_TYPE_TIMESTAMP:
+			bind.buffer_type = column.type;
+			bind.buffer = &column.time;
+			break;
+
+		default:
+			bind.buffer_type = MYSQL_TYPE_STRING;
+			bind.buffer = (void *)column.buffer.data();
+			bind.buffer_length = column.buffer.size();
+	}
+}
+
+bool MySQLStatementRes::fetch() {
+	int status = mysql_stmt_fetch(statement.stmt());
+
+	if (status == MYSQL_NO_DATA) return false;
+	if (status == 1) throw runtime_error(mysql_stmt_error(statement.stmt()) + string("\n") + statement.sql());
+
+	if (status == MYSQL_DATA_TRUNCATED) {
+		// some string values were longer than our buffers; enlarge those buffers and fetch the values again.  the
+		// buffers stay enlarged for the following rows, so that we rarely have to do this more than once.
+		bool rebind = false;
+		for (size_t column_number = 0; column_number < columns.size(); column_number++) {
+			Column &column(columns[column_number]);
+			if (!column.is_null && binds[column_number].buffer_type == MYSQL_TYPE_STRING && column.length > column.buffer.size()) {
+				column.buffer.resize(column.length);
+				bind_column(column_number);
+				if (mysql_stmt_fetch_column(statement.stmt(), &binds[column_number], column_number, 0)) {
+					throw runtime_error(mysql_stmt_error(statement.stmt()) + string("\n") + statement.sql());
+				}
+				rebind = true;
+			}
+		}
+		if (rebind && mysql_stmt_bind_result(statement.stmt(), binds.data())) {
+			throw runtime_error(mysql_stmt_error(statement.stmt()) + string("\n") + statement.sql());
+		}
+	}
+
+	return true;
+}
+
+class MySQLStatementRow {
+public:
+	inline MySQLStatementRow(MySQLStatementRes &res): _res(res) { }
+	inline const MySQLStatementRes &results() const { return _res; }
+
+	inline         int n_columns() const { return _res.n_columns(); }
+
+	inline        bool   null_at(int column_number) const { return _res.null_at(column_number); }
+	inline const void *result_at(int column_number) const { return _res.result_at(column_number); }
+	inline         int length_of(int column_number) const { return _res.length_of(column_number); }
+	inline      string string_at(int column_number) const { return string((char *)result_at(column_number), length_of(column_number)); }
+
+	template <typename Packer>
+	inline void pack_column_into(Packer &packer, int column_number) const {
+		// the values must be packed exactly as MySQLRow packs the same values from the text protocol, so that the
+		// hashes of the rows match
+		if (null_at(column_number)) {
+			packer << nullptr;
+		} else {
+			switch (_res.type_of(column_number)) {
+				case MYSQL_TYPE_TINY:
+					packer << (_res.int_at(column_number) == 1);
+					break;
+
+				case MYSQL_TYPE_SHORT:
+				case MYSQL_TYPE_INT24:
+				case MYSQL_TYPE_LONG:
+				case MYSQL_TYPE_LONGLONG:
+					if (_res.unsigned_at(column_number)) {
+						packer << (uint64_t)_res.int_at(column_number);
+					} else {
+						packer << _res.int_at(column_number);
+					}
+					break;
+
+				case MYSQL_TYPE_YEAR:
+				case MYSQL_TYPE_DATE:
+				case MYSQL_TYPE_TIME:
+				case MYSQL_TYPE_DATETIME:
+				case MYSQL_TYPE_TIMESTAMP: {
+					char buffer[64];
+					size_t length = format_temporal(buffer, sizeof(buffer), column_number);
+					packer << memory(buffer, length);
+					break;
+				}
+
+				default:
+					packer << memory(result_at(column_number), length_of(column_number));
+			}
+		}
+	}
+
+	template <typename Packer>
+	void pack_row_into(Packer &packer) const {
+		pack_array_length(packer, n_columns());
+
+		for (size_t column_number = 0; column_number < n_columns(); column_number++) {
+			pack_column_into(packer, column_number);
+		}
+	}
+
+private:
+	size_t format_temporal(char *buffer, size_t size, int column_number) const;
+
+	MySQLStatementRes &_res;
+};
+
+size_t MySQLStatementRow::format_temporal(char *buffer, size_t size, int column_number) const {
+	// formats the same way as the server does for the text protocol
+	const MYSQL_TIME &time(_res.time_at(column_number));
+	unsigned int decimals = _res.decimals_at(column_number);
+	int length;
+
+	switch (_res.type_of(column_number)) {
+		case MYSQL_TYPE_YEAR:
+			return snprintf(buffer, size, "%04u", (unsigned int)_res.int_at(column_number));
+
+		case MYSQL_TYPE_DATE:
+			return snprintf(buffer, size, "%04u-%02u-%02u", time.year, time.month, time.day);
+
+		case MYSQL_TYPE_TIME:
+			length = snprintf(buffer, size, "%s%02u:%02u:%02u", time.neg ? "-" : "", time.day*24 + time.hour, time.minute, time.second);
+			break;
+
+		default:
+			length = snprintf(buffer, size, "%04u-%02u-%02u %02u:%02u:%02u", time.year, time.month, time.day, time.hour, time.minute, time.second);
+	}
+
+	if (decimals > 0 && decimals <= 6) {
+		unsigned long fraction = time.second_part;
+		for (unsigned int n = decimals; n < 6; n++) fraction /= 10;
+		length += snprintf(buffer + length, size - length, ".%0*lu", (int)decimals, fraction);
+	}
+
+	return length;
+}
+
+// indexed by which of the key bounds and row count limit are used, see MySQLClient::statement_variant
+struct MySQLTableStatements {
+	unique_ptr<MySQLStatement> retrieve_rows[8];
+	unique_ptr<MySQLStatement> count_rows[4];
+};
+
+
 class MySQLClient: public SupportsReplace, public SupportsAddNonNullableColumns {
 public:
 	typedef MySQLRow RowType;
@@ -123,16 +556,60 @@ public:
 
 	template <typename RowReceiver>
 	size_t retrieve_rows(RowReceiver &row_packer, const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key, ssize_t row_count = NO_ROW_COUNT_LIMIT) {
-		return query(retrieve_rows_sql(*this, table, prev_key, last_key, row_count), row_packer, false /* nb. n_tuples won't work, which is ok since we send rows individually */);
+		if (!binary_results_supported(table)) {
+			return query(retrieve_rows_sql(*this, table, prev_key, last_key, row_count), row_packer, false /* nb. n_tuples won't work, which is ok since we send rows individually */);
+		}
+
+		// range queries are prepared once per table for each combination of key bounds and row count limit, since
+		// we may run many thousands of them; the results are read using the binary protocol
+		bool limited = (row_count != NO_ROW_COUNT_LIMIT);
+		unique_ptr<MySQLStatement> &statement(prepared_statements[table.name].retrieve_rows[statement_variant(prev_key, last_key, limited)]);
+		if (!statement) {
+			statement.reset(new MySQLStatement(mysql, retrieve_rows_parameterized_sql(*this, table, binary_select_columns_sql(table), !prev_key.empty(), !last_key.empty(), limited)));
+		}
+
+		MySQLParams params;
+		add_key_params(params, table, prev_key);
+		add_key_params(params, table, last_key);
+		if (limited) params.add((int64_t)row_count);
+		statement->execute(params);
+
+		MySQLStatementRes res(*statement);
+		size_t rows = 0;
+		while (res.fetch()) {
+			MySQLStatementRow row(res);
+			row_packer(row);
+			rows++;
+		}
+		return rows;
 	}
 
 	size_t count_rows(const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key) {
-		return atoi(select_one(count_rows_sql(*this, table, prev_key, last_key)).c_str());
+		unique_ptr<MySQLStatement> &statement(prepared_statements[table.name].count_rows[statement_variant(prev_key, last_key, false)]);
+		if (!statement) {
+			statement.reset(new MySQLStatement(mysql, count_rows_parameterized_sql(*this, table, !prev_key.empty(), !last_key.empty())));
+		}
+
+		MySQLParams params;
+		add_key_params(params, table, prev_key);
+		add_key_params(params, table, last_key);
+		return statement->select_one_integer(params);
+	}
+
+	bool retrieve_key_after_rows(ColumnValues &key, const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key, size_t rows) {
+		// the query selects only the key columns, so they're at the start of the row
+		ColumnIndices key_positions(table.primary_key_columns.size());
+		for (size_t n = 0; n < key_positions.size(); n++) key_positions[n] = n;
+		RowLastKey row_last_key(key_positions);
+		if (!query(key_after_rows_sql(*this, table, prev_key, last_key, rows), row_last_key, false)) return false;
+		key = row_last_key.last_key;
+		return true;
 	}
 
 	void execute(const string &sql);
 	void disable_referential_integrity();
 	void enable_referential_integrity();
+	void analyze_table(const Table &table);
 	string export_snapshot();
 	void import_snapshot(const string &snapshot);
 	void unhold_snapshot();
@@ -144,11 +621,16 @@ public:
 	void convert_unsupported_database_schema(Database &database);
 	string escape_value(const string &value);
 	inline string escape_column_value(const Column &column, const string &value) { return escape_value(value); }
+	void append_escaped_value_to(string &result, const char *value, size_t length);
+	inline void append_escaped_column_value_to(string &result, const Column &column, const char *value, size_t length) { append_escaped_value_to(result, value, length); }
 	string column_type(const Column &column);
 	string column_default(const Table &table, const Column &column);
 	string column_definition(const Table &table, const Column &column);
+	bool column_defaults_are_expressions();
 
 	inline char quote_identifiers_with() const { return '`'; }
+	inline string parameter_placeholder(size_t parameter_number) const { return "?"; }
+	inline string binary_collated(const string &expression) const { return "BINARY " + expression; }
 
 protected:
 	friend class MySQLTableLister;
@@ -178,6 +660,9 @@ protected:
 		return res.n_tuples();
 	}
 
+	string global_variable(const string &name);
+	void flush_tables_with_read_lock();
+
 	string select_one(const string &sql) {
 		if (mysql_real_query(&mysql, sql.c_str(), sql.length())) {
 			backtrace();
@@ -193,8 +678,44 @@ protected:
 		return MySQLRow(res, mysql_fetch_row(res.res())).string_at(0);
 	}
 
+	inline size_t statement_variant(const ColumnValues &prev_key, const ColumnValues &last_key, bool limited) {
+		return (prev_key.empty() ? 0 : 1) + (last_key.empty() ? 0 : 2) + (limited ? 4 : 0);
+	}
+
+	bool binary_results_supported(const Table &table) {
+		// filter expressions may return any type, so we leave those to the text protocol
+		for (const Column &column : table.columns) {
+			if (!column.filter_expression.empty()) return false;
+		}
+		return true;
+	}
+
+	string binary_select_columns_sql(const Table &table) {
+		// the server's text formatting of floating point values isn't something we can reproduce from the binary
+		// values, so we have it convert those to text for us
+		string result;
+		for (const Column &column : table.columns) {
+			if (!result.empty()) result += ", ";
+			if (column.column_type == ColumnTypes::REAL) result += "CAST(";
+			result += quote_identifiers_with();
+			result += column.name;
+			result += quote_identifiers_with();
+			if (column.column_type == ColumnTypes::REAL) result += " AS CHAR)";
+		}
+		return result;
+	}
+
+	void add_key_params(MySQLParams &params, const Table &table, const ColumnValues &key) {
+		if (key.empty()) return;
+		for (size_t n = 0; n < table.primary_key_columns.size(); n++) {
+			params.add(table.columns[table.primary_key_columns[n]], key[n]);
+		}
+	}
+
 private:
 	MYSQL mysql;
+	map<string, MySQLTableStatements> prepared_statements;
+	bool holding_backup_locks;
 
 	// forbid copying
 	MySQLClient(const MySQLClient& copy_from) { throw logic_error("copying forbidden"); }
@@ -205,7 +726,7 @@ MySQLClient::MySQLClient(
 	const string &database_port,
 	const string &database_name,
 	const string &database_username,
-	const string &database_password) {
+	const string &database_password): holding_backup_locks(false) {
 
 	// mysql_real_connect takes separate params for numeric ports and unix domain sockets
 	int port = 0;
@@ -230,10 +751,12 @@ MySQLClient::MySQLClient(
 }
 
 MySQLClient::~MySQLClient() {
+	prepared_statements.clear(); // statements must be closed before the connection
 	mysql_close(&mysql);
 }
 
 void MySQLClient::execute(const string &sql) {
+	TraceScope trace("db", "execute");
 	if (mysql_real_query(&mysql, sql.c_str(), sql.size())) {
 		throw runtime_error(mysql_error(&mysql) + string("\n") + sql);
 	}
@@ -261,21 +784,81 @@ void MySQLClient::rollback_transaction() {
 	execute("ROLLBACK");
 }
 
+struct MySQLVariableReader {
+	template <typename DatabaseRow>
+	void operator()(const DatabaseRow &row) {
+		value = row.string_at(1);
+	}
+
+	string value;
+};
+
+string MySQLClient::global_variable(const string &name) {
+	// returns an empty string if the server doesn't have the variable
+	MySQLVariableReader variable_reader;
+	query("SHOW GLOBAL VARIABLES LIKE '" + escape_value(name) + "'", variable_reader, true);
+	return variable_reader.value;
+}
+
 string MySQLClient::export_snapshot() {
 	// mysql's system catalogs are non-transactional and do not give a consistent snapshot; furthermore,
-	// it doesn't support export/import of transactions, so we need to exclude other transactions while
-	// we start up our set of read transactions so that they see consistent data.
-	execute("FLUSH NO_WRITE_TO_BINLOG TABLES"); // wait for current update statements to finish, without blocking other connections
-	execute("FLUSH TABLES WITH READ LOCK"); // then block other connections from updating/committing
+	// it doesn't support export/import of transactions, so we need to stop other transactions committing
+	// while we start up our set of read transactions so that they see consistent data.
+	if (global_variable("have_backup_locks") == "YES" && global_variable("log_bin") == "ON") {
+		// percona server's backup locks block DDL, non-transactional updates and commits, but unlike
+		// FLUSH TABLES WITH READ LOCK they don't need to wait for running queries to finish, and other
+		// connections can keep running statements (they just can't commit) while we hold them.  commits
+		// are blocked only because they would move the binlog position, so we need the binlog to be on.
+		execute("LOCK TABLES FOR BACKUP");
+		execute("LOCK BINLOG FOR BACKUP");
+		holding_backup_locks = true;
+	} else {
+		flush_tables_with_read_lock();
+	}
+
 	start_read_transaction(); // and start our transaction, and signal the other workers to start theirs
+
+	// if the server has GTIDs, pass on the set of transactions we can see so that the other workers can check
+	// that they see exactly the same set; otherwise the argument isn't needed
+	if (global_variable("gtid_mode") == "ON") {
+		return "gtid:" + select_one("SELECT @@global.gtid_executed");
+	}
 	return "locked";
 }
 
-void MySQLClient::import_snapshot(const string &snapshot) { // note the argument isn't needed for mysql
+void MySQLClient::flush_tables_with_read_lock() {
+	// FLUSH TABLES WITH READ LOCK has to wait for any running queries to finish, and blocks all other updates while
+	// it does; if that takes more than a few seconds, we let the other connections carry on for a while and retry
+	string lock_wait_timeout(select_one("SELECT @@session.lock_wait_timeout"));
+	execute("SET SESSION lock_wait_timeout = " + to_string(SNAPSHOT_LOCK_WAIT_TIMEOUT));
+
+	for (int attempt = 1; true; attempt++) {
+		try {
+			execute("FLUSH NO_WRITE_TO_BINLOG TABLES"); // wait for current update statements to finish, without blocking other connections
+			execute("FLUSH TABLES WITH READ LOCK"); // then block other connections from updating/committing
+			break;
+		} catch (const runtime_error &e) {
+			if (mysql_errno(&mysql) != ER_LOCK_WAIT_TIMEOUT || attempt == SNAPSHOT_LOCK_ATTEMPTS) throw;
+		}
+		this_thread::sleep_for(chrono::seconds(SNAPSHOT_LOCK_WAIT_TIMEOUT));
+	}
+
+	execute("SET SESSION lock_wait_timeout = " + lock_wait_timeout);
+}
+
+void MySQLClient::import_snapshot(const string &snapshot) {
 	start_read_transaction();
+
+	if (snapshot.substr(0, 5) == "gtid:" && "gtid:" + select_one("SELECT @@global.gtid_executed") != snapshot) {
+		throw runtime_error("Transactions were committed while the workers were starting their snapshots, so they wouldn't see consistent data");
+	}
 }
 
 void MySQLClient::unhold_snapshot() {
+	if (holding_backup_locks) {
+		execute("UNLOCK BINLOG");
+		holding_backup_locks = false;
+	}
 	execute("UNLOCK TABLES");
 }
 
@@ -287,14 +870,26 @@ void MySQLClient::enable_referential_integrity() {
 	execute("SET foreign_key_checks = 1");
 }
 
+void MySQLClient::analyze_table(const Table &table) {
+	// ANALYZE TABLE reports its outcome as a result set, which we have to read even though we don't need it
+	auto ignore_row = [](const MySQLRow &row) {};
+	query("ANALYZE TABLE " + table.name, ignore_row, false);
+}
+
 string MySQLClient::escape_value(const string &value) {
 	string result;
-	result.resize(value.size()*2 + 1);
-	size_t result_length = mysql_real_escape_string(&mysql, (char*)result.data(), value.c_str(), value.size());
-	result.resize(result_length);
+	append_escaped_value_to(result, value.data(), value.size());
 	return result;
 }
 
+void MySQLClient::append_escaped_value_to(string &result, const char *value, size_t length) {
+	// escape straight into the end of the destination string, then trim off the unused space
+	size_t size_before = result.size();
+	result.resize(size_before + length*2 + 1);
+	size_t escaped_length = mysql_real_escape_string(&mysql, &result[size_before], value, length);
+	result.resize(size_before + escaped_length);
+}
+
 void MySQLClient::convert_unsupported_database_schema(Database &database) {
 	// nothing yet
 }
@@ -455,16 +1050,32 @@ string MySQLClient::column_definition(const Table &table, const Column &column)
 	return result;
 }
 
+typedef map<string, Table*> TablesByName;
+
 struct MySQLColumnLister {
-	inline MySQLColumnLister(Table &table): table(table) {}
+	inline MySQLColumnLister(TablesByName &tables_by_name, bool defaults_are_expressions): tables_by_name(tables_by_name), defaults_are_expressions(defaults_are_expressions) {}
 
 	inline void operator()(MySQLRow &row) {
+		// the columns of all the tables are listed together; skip any for tables created since we listed the tables
+		TablesByName::iterator it = tables_by_name.find(row.string_at(6));
+		if (it == tables_by_name.end()) return;
+		Table &table(*it->second);
+
 		string name(row.string_at(0));
 		string db_type(row.string_at(1));
 		bool nullable(row.string_at(2) == "YES");
 		bool unsign(db_type.length() > 8 && db_type.substr(db_type.length() - 8, 8) == "unsigned");
 		DefaultType default_type(row.null_at(4) ? DefaultType::no_default : DefaultType::default_value);
 		string default_value(default_type ? row.string_at(4) : string(""));
+		if (default_type && defaults_are_expressions) {
+			// mariadb gives the default as the SQL to produce it, so string literals are quoted and NULL means none
+			if (default_value == "NULL") {
+				default_type = DefaultType::no_default;
+				default_value = "";
+			} else if (default_value.length() >= 2 && default_value[0] == '\'') {
+				default_value = unescape_value(default_value.substr(1, default_value.length() - 2));
+			}
+		}
 		if (row.string_at(5).find("auto_increment") != string::npos) default_type = DefaultType::sequence;
 
 		if (db_type == "tinyint(1)") {
@@ -516,15 +1127,45 @@ struct MySQLColumnLister {
 		} else {
 			throw runtime_error("Don't know how to represent mysql type of " + table.name + '.' + name + " (" + db_type + ")");
 		}
+
+		// the _bin collations compare by code point, which for utf8 is the order of the bytes (although collations
+		// with PAD SPACE ignore trailing spaces, which only puts values ending in control characters out of order)
+		string collation(row.null_at(7) ? string("") : row.string_at(7));
+		table.columns.back().binary_collation = (collation.length() > 4 && collation.substr(collation.length() - 4, 4) == "_bin");
 	}
 
-	Table &table;
+	inline string unescape_value(const string &escaped) {
+		string result;
+		result.reserve(escaped.length());
+		for (string::size_type n = 0; n < escaped.length(); n++) {
+			if (escaped[n] == '\'') {
+				n += 1;
+			} else if (escaped[n] == '\\') {
+				switch (escaped[++n]) {
+					case '0': result += '\0'; continue;
+					case 'n': result += '\n'; continue;
+					case 'r': result += '\r'; continue;
+					case 't': result += '\t'; continue;
+					case 'Z': result += '\032'; continue;
+				}
+			}
+			result += escaped[n];
+		}
+		return result;
+	}
+
+	TablesByName &tables_by_name;
+	bool defaults_are_expressions;
 };
 
 struct MySQLKeyLister {
-	inline MySQLKeyLister(Table &table): table(table) {}
+	inline MySQLKeyLister(TablesByName &tables_by_name): tables_by_name(tables_by_name) {}
 
 	inline void operator()(MySQLRow &row) {
+		TablesByName::iterator it = tables_by_name.find(row.string_at(0));
+		if (it == tables_by_name.end()) return;
+		Table &table(*it->second);
+
 		bool unique = (row.string_at(1) == "0");
 		string key_name = row.string_at(2);
 		string column_name = row.string_at(4);
@@ -548,33 +1189,68 @@ struct MySQLKeyLister {
 				string nullable = row.string_at(9);
 				if (unique && nullable == "YES") {
 					// mark this as unusable
-					unique_but_nullable_keys.insert(key_name);
+					unique_but_nullable_keys[table.name].insert(key_name);
 				}
 			}
 		}
 	}
 
-	Table &table;
-	set<string> unique_but_nullable_keys;
+	TablesByName &tables_by_name;
+	map<string, set<string>> unique_but_nullable_keys;
 };
 
 struct MySQLTableLister {
-	inline MySQLTableLister(MySQLClient &client, Database &database): client(client), database(database) {}
+	inline MySQLTableLister(Database &database): database(database) {}
 
 	inline void operator()(MySQLRow &row) {
 		Table table(row.string_at(0));
+		table.estimated_size = row.uint_at(1);
+		table.estimated_rows = row.uint_at(2);
+		database.tables.push_back(table);
+	}
+
+private:
+	Database &database;
+};
+
+bool MySQLClient::column_defaults_are_expressions() {
+	// from 10.2.7, mariadb's information_schema.columns gives defaults as expressions rather than values
+	const char *server_info = mysql_get_server_info(&mysql);
+	if (strstr(server_info, "MariaDB") == nullptr) return false;
+	if (strncmp(server_info, "5.5.5-", 6) == 0) server_info += 6; // prefix added for the sake of old replication clients
+	unsigned long major = 0, minor = 0, patch = 0;
+	sscanf(server_info, "%lu.%lu.%lu", &major, &minor, &patch);
+	return (major*10000 + minor*100 + patch >= MARIADB_10_2_7);
+}
+
+void MySQLClient::populate_database_schema(Database &database) {
+	size_t first_table = database.tables.size();
+	MySQLTableLister table_lister(database);
+	query("SELECT table_name, COALESCE(data_length, 0) + COALESCE(index_length, 0), COALESCE(table_rows, 0) FROM information_schema.tables WHERE table_schema = schema() ORDER BY data_length DESC, table_name ASC", table_lister, false);
 
-		MySQLColumnLister column_lister(table);
-		client.query("SHOW COLUMNS FROM " + table.name, column_lister, false);
+	TablesByName tables_by_name;
+	for (size_t n = first_table; n < database.tables.size(); n++) {
+		tables_by_name[database.tables[n].name] = &database.tables[n];
+	}
 
-		MySQLKeyLister key_lister(table);
-		client.query("SHOW KEYS FROM " + table.name, key_lister, false);
+	// load the columns and keys of all the tables at once, rather than running SHOW COLUMNS and SHOW KEYS for each
+	// table, which takes thousands of round trips on schemas with thousands of tables.  the columns are selected in
+	// the same order as SHOW COLUMNS and SHOW KEYS return them, with the table name added for SHOW COLUMNS.
+	MySQLColumnLister column_lister(tables_by_name, column_defaults_are_expressions());
+	query("SELECT column_name, column_type, is_nullable, column_key, column_default, extra, table_name, collation_name FROM information_schema.columns WHERE table_schema = schema() ORDER BY table_name, ordinal_position", column_lister, false);
+
+	MySQLKeyLister key_lister(tables_by_name);
+	query("SELECT table_name, non_unique, index_name, seq_in_index, column_name, collation, cardinality, sub_part, packed, nullable FROM information_schema.statistics WHERE table_schema = schema() ORDER BY table_name, index_name = 'PRIMARY' DESC, index_name, seq_in_index", key_lister, false);
+
+	for (size_t n = first_table; n < database.tables.size(); n++) {
+		Table &table(database.tables[n]);
 
 		// if the table has no primary key, we need to find a unique key with no nullable columns to act as a surrogate primary key
 		sort(table.keys.begin(), table.keys.end()); // order is arbitrary for keys, but both ends must be consistent, so we sort the keys by name
 
+		const set<string> &unique_but_nullable_keys(key_lister.unique_but_nullable_keys[table.name]);
 		for (Keys::const_iterator key = table.keys.begin(); key != table.keys.end() && table.primary_key_columns.empty(); ++key) {
-			if (key->unique && !key_lister.unique_but_nullable_keys.count(key->name)) {
+			if (key->unique && !unique_but_nullable_keys.count(key->name)) {
 				table.primary_key_columns = key->columns;
 			}
 		}
@@ -582,18 +1258,7 @@ struct MySQLTableLister {
 			// of course this falls apart if there are no unique keys, so we don't allow that
 			throw runtime_error("Couldn't find a primary or non-nullable unique key on table " + table.name);
 		}
-
-		database.tables.push_back(table);
 	}
-
-private:
-	MySQLClient &client;
-	Database &database;
-};
-
-void MySQLClient::populate_database_schema(Database &database) {
-	MySQLTableLister table_lister(*this, database);
-	query("SELECT table_name FROM information_schema.tables WHERE table_schema = schema() ORDER BY data_length DESC, table_name ASC", table_lister, true /* buffer so we can make further queries during iteration */);
 }
 
 
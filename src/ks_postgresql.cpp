@@ -18,14 +18,33 @@ public:
 	inline int n_tuples() const  { return _n_tuples; }
 	inline int n_columns() const { return _n_columns; }
 	inline Oid type_of(int column_number) const { return types[column_number]; }
+	inline bool binary_at(int column_number) const { return binary[column_number]; }
+
+	// used for the subsequent results from the same query in single-row mode, which all have the same columns
+	inline void replace(PGresult *res) {
+		if (_res) PQclear(_res);
+		_res = res;
+		_n_tuples = (_res ? PQntuples(_res) : 0);
+	}
 
 private:
 	PGresult *_res;
 	int _n_tuples;
 	int _n_columns;
 	vector<Oid> types;
+	vector<bool> binary;
 };
 
+// from pg_type.h, which isn't available/working on all distributions.
+#define BOOLOID			16
+#define BYTEAOID		17
+#define INT2OID			21
+#define INT4OID			23
+#define INT8OID			20
+#define TEXTOID			25
+#define BPCHAROID		1042
+#define VARCHAROID		1043
+
 PostgreSQLRes::PostgreSQLRes(PGresult *res) {
 	_res = res;
 
@@ -33,8 +52,17 @@ PostgreSQLRes::PostgreSQLRes(PGresult *res) {
 	_n_columns = PQnfields(_res);
 
 	types.resize(_n_columns);
+	binary.resize(_n_columns);
 	for (size_t i = 0; i < _n_columns; i++) {
 		types[i] = PQftype(_res, i);
+		binary[i] = (PQfformat(_res, i) == 1);
+
+		// we only know how to read the binary format for these types; everything else must be requested as text
+		if (binary[i] && types[i] != BOOLOID && types[i] != BYTEAOID && types[i] != INT2OID && types[i] != INT4OID && types[i] != INT8OID &&
+			types[i] != TEXTOID && types[i] != BPCHAROID && types[i] != VARCHAROID) {
+			PQclear(_res);
+			throw logic_error("Can't read binary format results for type " + to_string(types[i]));
+		}
 	}
 }
 
@@ -45,13 +73,6 @@ PostgreSQLRes::~PostgreSQLRes() {
 }
 
 
-// from pg_type.h, which isn't available/working on all distributions.
-#define BOOLOID			16
-#define BYTEAOID		17
-#define INT2OID			21
-#define INT4OID			23
-#define INT8OID			20
-
 class PostgreSQLRow {
 public:
 	inline PostgreSQLRow(PostgreSQLRes &res, int row_number): _res(res), _row_number(row_number) { }
@@ -63,9 +84,10 @@ public:
 	inline const void *result_at(int column_number) const { return PQgetvalue (_res.res(), _row_number, column_number); }
 	inline         int length_of(int column_number) const { return PQgetlength(_res.res(), _row_number, column_number); }
 	inline      string string_at(int column_number) const { return string((const char *)result_at(column_number), length_of(column_number)); }
-	inline        bool   bool_at(int column_number) const { return (strcmp((const char *)result_at(column_number), "t") == 0); }
-	inline     int64_t    int_at(int column_number) const { return strtoll((const char *)result_at(column_number), NULL, 10); }
+	inline        bool   bool_at(int column_number) const { return (_res.binary_at(column_number) ? *(const char *)result_at(column_number) != 0 : strcmp((const char *)result_at(column_number), "t") == 0); }
+	inline     int64_t    int_at(int column_number) const { return (_res.binary_at(column_number) ? binary_int_at(column_number) : strtoll((const char *)result_at(column_number), NULL, 10)); }
 
+	int64_t binary_int_at(int column_number) const;
 	string decoded_byte_string_at(int column_number) const;
 
 	template <typename Packer>
@@ -79,7 +101,12 @@ public:
 					break;
 
 				case BYTEAOID:
-					packer << decoded_byte_string_at(column_number);
+					if (_res.binary_at(column_number)) {
+						// the binary format is simply the bytes themselves
+						packer << memory(result_at(column_number), length_of(column_number));
+					} else {
+						packer << decoded_byte_string_at(column_number);
+					}
 					break;
 
 				case INT2OID:
@@ -109,6 +136,28 @@ private:
 	int _row_number;
 };
 
+int64_t PostgreSQLRow::binary_int_at(int column_number) const {
+	switch (_res.type_of(column_number)) {
+		case INT2OID: {
+			int16_t value;
+			memcpy(&value, result_at(column_number), sizeof(value));
+			return (int16_t)ntohs(value);
+		}
+
+		case INT4OID: {
+			int32_t value;
+			memcpy(&value, result_at(column_number), sizeof(value));
+			return (int32_t)ntohl(value);
+		}
+
+		default: {
+			int64_t value;
+			memcpy(&value, result_at(column_number), sizeof(value));
+			return (int64_t)ntohll(value);
+		}
+	}
+}
+
 string PostgreSQLRow::decoded_byte_string_at(int column_number) const {
 	const unsigned char *value = (const unsigned char *)result_at(column_number);
 	size_t decoded_length;
@@ -119,7 +168,149 @@ string PostgreSQLRow::decoded_byte_string_at(int column_number) const {
 }
 
 
-class PostgreSQLClient: public GlobalKeys, public SequenceColumns, public DropKeysWhenColumnsDropped, public SetNullability {
+// parameter values for prepared statements.  integer, boolean and bytea values are sent in binary format where the
+// statement declared that type for the parameter; everything else is sent as text for the server to interpret.
+class PostgreSQLParams {
+public:
+	static Oid key_parameter_type(const Column &column);
+
+	void add(Oid type, const PackedValue &value);
+	void add(int64_t value);
+
+	inline int n_params() const { return buffers.size(); }
+	const char * const *values();
+	inline const int *lengths() const { return _lengths.data(); }
+	inline const int *formats() const { return _formats.data(); }
+
+private:
+	void add_binary(const void *data, size_t length);
+	void add_text(const string &value);
+
+	vector<string> buffers;
+	vector<bool> nulls;
+	vector<int> _lengths;
+	vector<int> _formats;
+	vector<const char *> pointers;
+};
+
+Oid PostgreSQLParams::key_parameter_type(const Column &column) {
+	if (column.column_type == ColumnTypes::SINT || column.column_type == ColumnTypes::UINT) {
+		// the integer types all have cross-type comparison operators, so we can use bigint for all sizes
+		return INT8OID;
+	} else if (column.column_type == ColumnTypes::BOOL) {
+		return BOOLOID;
+	} else if (column.column_type == ColumnTypes::BLOB) {
+		return BYTEAOID;
+	} else {
+		return 0; // let the server infer the type from the column, and send the value as text
+	}
+}
+
+void PostgreSQLParams::add(Oid type, const PackedValue &value) {
+	if (value.is_nil()) {
+		buffers.emplace_back();
+		nulls.push_back(true);
+		_lengths.push_back(0);
+		_formats.push_back(0);
+		return;
+	}
+
+	if (value.is_false() || value.is_true()) {
+		if (type == BOOLOID) {
+			char byte = value.is_true();
+			add_binary(&byte, 1);
+		} else {
+			add_text(value.is_true() ? "true" : "false");
+		}
+		return;
+	}
+
+	VectorReadStream stream(value);
+	Unpacker<VectorReadStream> unpacker(stream);
+	uint8_t leader = value.leader();
+
+	if ((leader >= MSGPACK_POSITIVE_FIXNUM_MIN && leader <= MSGPACK_POSITIVE_FIXNUM_MAX) ||
+		(leader >= MSGPACK_NEGATIVE_FIXNUM_MIN && leader <= MSGPACK_NEGATIVE_FIXNUM_MAX) ||
+		leader == MSGPACK_INT8 || leader == MSGPACK_INT16 || leader == MSGPACK_INT32 || leader == MSGPACK_INT64 ||
+		leader == MSGPACK_UINT8 || leader == MSGPACK_UINT16 || leader == MSGPACK_UINT32) {
+		int64_t integer = unpacker.template next<int64_t>();
+		if (type == INT8OID) {
+			uint64_t network_order = htonll((uint64_t)integer);
+			add_binary(&network_order, sizeof(network_order));
+		} else {
+			add_text(to_string(integer));
+		}
+		return;
+	}
+
+	switch (leader) {
+		case MSGPACK_UINT64:
+			// may not fit in a bigint, so let the server check
+			add_text(to_string(unpacker.template next<uint64_t>()));
+			break;
+
+		case MSGPACK_FLOAT:
+			add_text(to_string(unpacker.template next<float>()));
+			break;
+
+		case MSGPACK_DOUBLE:
+			add_text(to_string(unpacker.template next<double>()));
+			break;
+
+		default:
+			string bytes(unpacker.template next<string>());
+			if (type == BYTEAOID) {
+				add_binary(bytes.data(), bytes.size());
+			} else {
+				add_text(bytes);
+			}
+	}
+}
+
+void PostgreSQLParams::add(int64_t value) {
+	uint64_t network_order = htonll((uint64_t)value);
+	add_binary(&network_order, sizeof(network_order));
+}
+
+void PostgreSQLParams::add_binary(const void *data, size_t length) {
+	buffers.emplace_back((const char *)data, length);
+	nulls.push_back(false);
+	_lengths.push_back(length);
+	_formats.push_back(1);
+}
+
+void PostgreSQLParams::add_text(const string &value) {
+	buffers.push_back(value);
+	nulls.push_back(false);
+	_lengths.push_back(value.size());
+	_formats.push_back(0);
+}
+
+const char * const *PostgreSQLParams::values() {
+	// the buffers may have moved as they were added, so we only take pointers to them once they're all present
+	pointers.resize(buffers.size());
+	for (size_t n = 0; n < buffers.size(); n++) {
+		pointers[n] = nulls[n] ? nullptr : buffers[n].data();
+	}
+	return pointers.data();
+}
+
+struct PostgreSQLStatement {
+	PostgreSQLStatement(): result_format(0) {}
+
+	string name;
+	string sql;
+	int result_format;
+};
+
+// indexed by which of the key bounds and row count limit are used, see PostgreSQLClient::statement_variant
+struct PostgreSQLTableStatements {
+	PostgreSQLStatement retrieve_rows[8];
+	PostgreSQLStatement count_rows[4];
+};
+
+
+class PostgreSQLClient: public GlobalKeys, public SequenceColumns, public DropKeysWhenColumnsDropped, public SetNullability, public TransactionalDDL, public SupportsCreateKeysConcurrently {
 public:
 	typedef PostgreSQLRow RowType;
 
@@ -133,16 +324,48 @@ public:
 
 	template <typename RowReceiver>
 	size_t retrieve_rows(RowReceiver &row_packer, const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key, ssize_t row_count = NO_ROW_COUNT_LIMIT) {
-		return query(retrieve_rows_sql(*this, table, prev_key, last_key, row_count), row_packer);
+		bool limited = (row_count != NO_ROW_COUNT_LIMIT);
+		PostgreSQLStatement &statement(statements_for(table).retrieve_rows[statement_variant(prev_key, last_key, limited)]);
+		if (statement.name.empty()) {
+			// we use binary format results where we can, to avoid converting numbers to text and back and the bytea escaping
+			bool binary = binary_results_supported(table);
+			prepare(statement, table, retrieve_rows_parameterized_sql(*this, table, binary ? binary_select_columns_sql(table) : select_columns_sql(*this, table), !prev_key.empty(), !last_key.empty(), limited), prev_key, last_key, limited);
+			statement.result_format = (binary ? 1 : 0);
+		}
+
+		PostgreSQLParams params;
+		add_key_params(params, table, prev_key);
+		add_key_params(params, table, last_key);
+		if (limited) params.add((int64_t)row_count);
+		return stream_prepared(statement, params, row_packer);
 	}
 
 	size_t count_rows(const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key) {
-		return atoi(select_one(count_rows_sql(*this, table, prev_key, last_key)).c_str());
+		PostgreSQLStatement &statement(statements_for(table).count_rows[statement_variant(prev_key, last_key, false)]);
+		if (statement.name.empty()) {
+			prepare(statement, table, count_rows_parameterized_sql(*this, table, !prev_key.empty(), !last_key.empty()), prev_key, last_key, false);
+		}
+
+		PostgreSQLParams params;
+		add_key_params(params, table, prev_key);
+		add_key_params(params, table, last_key);
+		return atoi(select_one_prepared(statement, params).c_str());
+	}
+
+	bool retrieve_key_after_rows(ColumnValues &key, const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key, size_t rows) {
+		// the query selects only the key columns, so they're at the start of the row
+		ColumnIndices key_positions(table.primary_key_columns.size());
+		for (size_t n = 0; n < key_positions.size(); n++) key_positions[n] = n;
+		RowLastKey row_last_key(key_positions);
+		if (!query(key_after_rows_sql(*this, table, prev_key, last_key, rows), row_last_key)) return false;
+		key = row_last_key.last_key;
+		return true;
 	}
 
 	void execute(const string &sql);
 	void disable_referential_integrity();
 	void enable_referential_integrity();
+	void analyze_table(const Table &table);
 	string export_snapshot();
 	void import_snapshot(const string &snapshot);
 	void unhold_snapshot();
@@ -154,12 +377,16 @@ public:
 	void convert_unsupported_database_schema(Database &database);
 	string escape_value(const string &value);
 	string escape_column_value(const Column &column, const string &value);
+	void append_escaped_value_to(string &result, const char *value, size_t length);
+	void append_escaped_column_value_to(string &result, const Column &column, const char *value, size_t length);
 	string column_type(const Column &column);
 	string column_sequence_name(const Table &table, const Column &column);
 	string column_default(const Table &table, const Column &column);
 	string column_definition(const Table &table, const Column &column);
 
 	inline char quote_identifiers_with() const { return '"'; }
+	inline string parameter_placeholder(size_t parameter_number) const { return "$" + to_string(parameter_number); }
+	inline string binary_collated(const string &expression) const { return expression + " COLLATE \"C\""; }
 
 protected:
 	friend class PostgreSQLTableLister;
@@ -167,7 +394,54 @@ protected:
 	template <typename RowFunction>
 	size_t query(const string &sql, RowFunction &row_handler) {
 		PostgreSQLRes res(PQexecParams(conn, sql.c_str(), 0, nullptr, nullptr, nullptr, nullptr, 0 /* text-format results only */));
+		return handle_rows(res, sql, row_handler);
+	}
+
+	template <typename RowFunction>
+	size_t stream_prepared(const PostgreSQLStatement &statement, PostgreSQLParams &params, RowFunction &row_handler) {
+		// rather than have libpq buffer the whole result set, we ask for each row as soon as it arrives, so that
+		// we can hash or send it straight away and don't hold large ranges in memory.  note that this means the
+		// row handler can't run other queries on this connection.
+		if (!PQsendQueryPrepared(conn, statement.name.c_str(), params.n_params(), params.values(), params.lengths(), params.formats(), statement.result_format)) {
+			backtrace();
+			throw runtime_error(PQerrorMessage(conn) + string("\n") + statement.sql);
+		}
+		PQsetSingleRowMode(conn); // if this fails we'll simply get all the rows in one result
+
+		PostgreSQLRes res(PQgetResult(conn));
+		size_t row_count = 0;
+		string error;
+
+		try {
+			while (res.res()) {
+				if (res.status() == PGRES_SINGLE_TUPLE || res.status() == PGRES_TUPLES_OK) {
+					for (int row_number = 0; row_number < res.n_tuples(); row_number++) {
+						PostgreSQLRow row(res, row_number);
+						row_handler(row);
+						row_count++;
+					}
+				} else if (error.empty()) {
+					error = PQerrorMessage(conn);
+				}
+				res.replace(PQgetResult(conn));
+			}
+		} catch (...) {
+			// the connection can't be used again until all the results have been read, so ask the server to stop sending them
+			cancel_query();
+			while (res.res()) res.replace(PQgetResult(conn));
+			throw;
+		}
 
+		if (!error.empty()) {
+			backtrace();
+			throw runtime_error(error + "\n" + statement.sql);
+		}
+
+		return row_count;
+	}
+
+	template <typename RowFunction>
+	size_t handle_rows(PostgreSQLRes &res, const string &sql, RowFunction &row_handler) {
 		if (res.status() != PGRES_TUPLES_OK) {
 			backtrace();
 			throw runtime_error(PQerrorMessage(conn) + string("\n") + sql);
@@ -183,7 +457,15 @@ protected:
 
 	string select_one(const string &sql) {
 		PostgreSQLRes res(PQexecParams(conn, sql.c_str(), 0, nullptr, nullptr, nullptr, nullptr, 0 /* text-format results only */));
+		return handle_one(res, sql);
+	}
+
+	string select_one_prepared(const PostgreSQLStatement &statement, PostgreSQLParams &params) {
+		PostgreSQLRes res(PQexecPrepared(conn, statement.name.c_str(), params.n_params(), params.values(), params.lengths(), params.formats(), 0 /* text-format results only */));
+		return handle_one(res, statement.sql);
+	}
 
+	string handle_one(PostgreSQLRes &res, const string &sql) {
 		if (res.status() != PGRES_TUPLES_OK) {
 			backtrace();
 			throw runtime_error(PQerrorMessage(conn) + string("\n") + sql);
@@ -196,8 +478,26 @@ protected:
 		return PostgreSQLRow(res, 0).string_at(0);
 	}
 
+	// range queries are prepared once per table for each combination of key bounds and row count limit, since
+	// we run many thousands of them and would otherwise spend much of our time building, parsing and planning
+	inline PostgreSQLTableStatements &statements_for(const Table &table) {
+		return prepared_statements[table.name];
+	}
+
+	inline size_t statement_variant(const ColumnValues &prev_key, const ColumnValues &last_key, bool limited) {
+		return (prev_key.empty() ? 0 : 1) + (last_key.empty() ? 0 : 2) + (limited ? 4 : 0);
+	}
+
+	void cancel_query();
+	bool binary_results_supported(const Table &table);
+	string binary_select_columns_sql(const Table &table);
+	void prepare(PostgreSQLStatement &statement, const Table &table, const string &sql, const ColumnValues &prev_key, const ColumnValues &last_key, bool limited);
+	void add_key_params(PostgreSQLParams &params, const Table &table, const ColumnValues &key);
+
 private:
 	PGconn *conn;
+	map<string, PostgreSQLTableStatements> prepared_statements;
+	size_t prepared_statements_count;
 
 	// forbid copying
 	PostgreSQLClient(const PostgreSQLClient& copy_from) { throw logic_error("copying forbidden"); }
@@ -208,7 +508,7 @@ PostgreSQLClient::PostgreSQLClient(
 	const string &database_port,
 	const string &database_name,
 	const string &database_username,
-	const string &database_password) {
+	const string &database_password): prepared_statements_count(0) {
 
 	const char *keywords[] = { "host",                "port",                "dbname",              "user",                    "password",                nullptr };
 	const char *values[]   = { database_host.c_str(), database_port.c_str(), database_name.c_str(), database_username.c_str(), database_password.c_str(), nullptr };
@@ -225,6 +525,74 @@ PostgreSQLClient::PostgreSQLClient(
 	execute("SET client_min_messages TO WARNING");
 }
 
+void PostgreSQLClient::prepare(PostgreSQLStatement &statement, const Table &table, const string &sql, const ColumnValues &prev_key, const ColumnValues &last_key, bool limited) {
+	vector<Oid> types;
+	for (const ColumnValues *key : { &prev_key, &last_key }) {
+		if (!key->empty()) {
+			for (size_t column_index : table.primary_key_columns) {
+				types.push_back(PostgreSQLParams::key_parameter_type(table.columns[column_index]));
+			}
+		}
+	}
+	if (limited) {
+		types.push_back(INT8OID);
+	}
+
+	string name("ks_" + to_string(++prepared_statements_count));
+	PostgreSQLRes res(PQprepare(conn, name.c_str(), sql.c_str(), types.size(), types.data()));
+
+	if (res.status() != PGRES_COMMAND_OK) {
+		backtrace();
+		throw runtime_error(PQerrorMessage(conn) + string("\n") + sql);
+	}
+
+	statement.name = name;
+	statement.sql = sql;
+}
+
+void PostgreSQLClient::cancel_query() {
+	PGcancel *cancel = PQgetCancel(conn);
+	if (cancel) {
+		char error[256];
+		PQcancel(cancel, error, sizeof(error)); // best-effort; we still read any results that it didn't stop
+		PQfreeCancel(cancel);
+	}
+}
+
+bool PostgreSQLClient::binary_results_supported(const Table &table) {
+	// filter expressions may return any type, so we can't be sure we'd be able to read their binary format
+	for (const Column &column : table.columns) {
+		if (!column.filter_expression.empty()) return false;
+	}
+	return true;
+}
+
+string PostgreSQLClient::binary_select_columns_sql(const Table &table) {
+	// the binary format for the integer, boolean, bytea and string types gives us the values we pack anyway.  we
+	// have the server convert the other types to text, which gives the same representation as text format results,
+	// so that the rows we pack and hash are the same whichever format was used.
+	string result;
+	for (const Column &column : table.columns) {
+		if (!result.empty()) result += ", ";
+		result += quote_identifiers_with();
+		result += column.name;
+		result += quote_identifiers_with();
+		if (column.column_type != ColumnTypes::SINT && column.column_type != ColumnTypes::UINT && column.column_type != ColumnTypes::BOOL &&
+			column.column_type != ColumnTypes::BLOB && column.column_type != ColumnTypes::TEXT &&
+			column.column_type != ColumnTypes::VCHR && column.column_type != ColumnTypes::FCHR) {
+			result += "::text";
+		}
+	}
+	return result;
+}
+
+void PostgreSQLClient::add_key_params(PostgreSQLParams &params, const Table &table, const ColumnValues &key) {
+	if (key.empty()) return;
+	for (size_t n = 0; n < table.primary_key_columns.size(); n++) {
+		params.add(PostgreSQLParams::key_parameter_type(table.columns[table.primary_key_columns[n]]), key[n]);
+	}
+}
+
 PostgreSQLClient::~PostgreSQLClient() {
 	if (conn) {
 		PQfinish(conn);
@@ -232,6 +600,7 @@ PostgreSQLClient::~PostgreSQLClient() {
 }
 
 void PostgreSQLClient::execute(const string &sql) {
+	TraceScope trace("db", "execute");
     PostgreSQLRes res(PQexec(conn, sql.c_str()));
 
     if (res.status() != PGRES_COMMAND_OK && res.status() != PGRES_TUPLES_OK) {
@@ -289,26 +658,44 @@ void PostgreSQLClient::enable_referential_integrity() {
 	*/
 }
 
+void PostgreSQLClient::analyze_table(const Table &table) {
+	execute("ANALYZE " + table.name);
+}
+
 string PostgreSQLClient::escape_value(const string &value) {
 	string result;
-	result.resize(value.size()*2 + 1);
-	size_t result_length = PQescapeStringConn(conn, (char*)result.data(), value.c_str(), value.size(), nullptr);
-	result.resize(result_length);
+	append_escaped_value_to(result, value.data(), value.size());
 	return result;
 }
 
 string PostgreSQLClient::escape_column_value(const Column &column, const string &value) {
+	string result;
+	append_escaped_column_value_to(result, column, value.data(), value.size());
+	return result;
+}
+
+void PostgreSQLClient::append_escaped_value_to(string &result, const char *value, size_t length) {
+	// escape straight into the end of the destination string, then trim off the unused space
+	size_t size_before = result.size();
+	result.resize(size_before + length*2 + 1);
+	size_t escaped_length = PQescapeStringConn(conn, &result[size_before], value, length, nullptr);
+	result.resize(size_before + escaped_length);
+}
+
+void PostgreSQLClient::append_escaped_column_value_to(string &result, const Column &column, const char *value, size_t length) {
 	if (column.column_type != ColumnTypes::BLOB) {
-		return escape_value(value);
+		append_escaped_value_to(result, value, length);
+		return;
 	}
 
 	size_t encoded_length;
-	const unsigned char *encoded = PQescapeByteaConn(conn, (const unsigned char *)value.c_str(), value.size(), &encoded_length);
-	string result(encoded, encoded + encoded_length);
-	PQfreemem((void *)encoded);
+	unsigned char *encoded = PQescapeByteaConn(conn, (const unsigned char *)value, length, &encoded_length);
+	if (!encoded) throw bad_alloc();
 
-	// bizarrely, the bytea parser is an extra level on top of the normal escaping, so you still need the latter after PQescapeByteaConn, even though PQunescapeBytea doesn't do the reverse
-	return escape_value(result);
+	// bizarrely, the bytea parser is an extra level on top of the normal escaping, so you still need the latter after PQescapeByteaConn, even though PQunescapeBytea doesn't do the reverse.
+	// nb. encoded_length includes the terminating null.
+	append_escaped_value_to(result, (const char *)encoded, encoded_length - 1);
+	PQfreemem(encoded);
 }
 
 void PostgreSQLClient::convert_unsupported_database_schema(Database &database) {
@@ -468,19 +855,22 @@ string PostgreSQLClient::column_definition(const Table &table, const Column &col
 	return result;
 }
 
+typedef map<string, Table*> TablesByName;
+
 struct PostgreSQLColumnLister {
-	inline PostgreSQLColumnLister(Table &table): table(table) {}
+	inline PostgreSQLColumnLister(TablesByName &tables_by_name): tables_by_name(tables_by_name) {}
 
 	inline void operator()(PostgreSQLRow &row) {
-		string name(row.string_at(0));
-		string db_type(row.string_at(1));
-		bool nullable(row.string_at(2) == "f");
+		Table &table(*tables_by_name.at(row.string_at(0)));
+		string name(row.string_at(1));
+		string db_type(row.string_at(2));
+		bool nullable(row.string_at(3) == "f");
 		DefaultType default_type(DefaultType::no_default);
 		string default_value;
 
-		if (row.string_at(3) == "t") {
+		if (row.string_at(4) == "t") {
 			default_type = DefaultType::default_value;
-			default_value = row.string_at(4);
+			default_value = row.string_at(5);
 			if (default_value.length() > 20 &&
 				default_value.substr(0, 9) == "nextval('" &&
 				default_value.substr(default_value.length() - 12, 12) == "'::regclass)") {
@@ -522,6 +912,8 @@ struct PostgreSQLColumnLister {
 		} else {
 			throw runtime_error("Don't know how to represent postgresql type of " + table.name + '.' + name + " (" + db_type + ")");
 		}
+
+		table.columns.back().binary_collation = (row.string_at(6) == "t");
 	}
 
 	inline string unescape_value(const string &escaped) {
@@ -538,30 +930,32 @@ struct PostgreSQLColumnLister {
 		return result;
 	}
 
-	Table &table;
+	TablesByName &tables_by_name;
 };
 
 struct PostgreSQLPrimaryKeyLister {
-	inline PostgreSQLPrimaryKeyLister(Table &table): table(table) {}
+	inline PostgreSQLPrimaryKeyLister(TablesByName &tables_by_name): tables_by_name(tables_by_name) {}
 
 	inline void operator()(PostgreSQLRow &row) {
-		string column_name = row.string_at(0);
+		Table &table(*tables_by_name.at(row.string_at(0)));
+		string column_name = row.string_at(1);
 		size_t column_index = table.index_of_column(column_name);
 		table.primary_key_columns.push_back(column_index);
 	}
 
-	Table &table;
+	TablesByName &tables_by_name;
 };
 
 struct PostgreSQLKeyLister {
-	inline PostgreSQLKeyLister(Table &table): table(table) {}
+	inline PostgreSQLKeyLister(TablesByName &tables_by_name): tables_by_name(tables_by_name) {}
 
 	inline void operator()(PostgreSQLRow &row) {
-		// if we have no primary key, we might need to use another unique key as a surrogate - see PostgreSQLTableLister below
+		// if we have no primary key, we might need to use another unique key as a surrogate - see populate_database_schema below
 		// furthermore this key must have no NULLable columns, as they effectively make the index not unique
-		string key_name = row.string_at(0);
-		bool unique = (row.string_at(1) == "t");
-		string column_name = row.string_at(2);
+		Table &table(*tables_by_name.at(row.string_at(0)));
+		string key_name = row.string_at(1);
+		bool unique = (row.string_at(2) == "t");
+		string column_name = row.string_at(3);
 		size_t column_index = table.index_of_column(column_name);
 		// FUTURE: consider representing collation, index type, partial keys etc.
 
@@ -573,87 +967,106 @@ struct PostgreSQLKeyLister {
 		if (table.primary_key_columns.empty()) {
 			// if we have no primary key, we might need to use another unique key as a surrogate - see MySQLTableLister below -
 			// but this key must have no NULLable columns, as they effectively make the index not unique
-			bool nullable = (row.string_at(3) == "f");
+			bool nullable = (row.string_at(4) == "f");
 			if (unique && nullable) {
 				// mark this as unusable
-				unique_but_nullable_keys.insert(key_name);
+				unique_but_nullable_keys[table.name].insert(key_name);
 			}
 		}
 	}
 
-	Table &table;
-	set<string> unique_but_nullable_keys;
+	TablesByName &tables_by_name;
+	map<string, set<string>> unique_but_nullable_keys;
 };
 
 struct PostgreSQLTableLister {
-	PostgreSQLTableLister(PostgreSQLClient &client, Database &database): client(client), database(database) {}
+	PostgreSQLTableLister(Database &database): database(database) {}
 
 	void operator()(PostgreSQLRow &row) {
 		Table table(row.string_at(0));
-
-		PostgreSQLColumnLister column_lister(table);
-		client.query(
-			"SELECT attname, format_type(atttypid, atttypmod), attnotnull, atthasdef, pg_get_expr(adbin, adrelid) "
-			  "FROM pg_attribute "
-			  "JOIN pg_class ON attrelid = pg_class.oid "
-			  "JOIN pg_type ON atttypid = pg_type.oid "
-			  "LEFT JOIN pg_attrdef ON adrelid = attrelid AND adnum = attnum "
-			 "WHERE attnum > 0 AND "
-			       "NOT attisdropped AND "
-			       "relname = '" + table.name + "' "
-			 "ORDER BY attnum",
-			column_lister);
-
-		PostgreSQLPrimaryKeyLister primary_key_lister(table);
-		client.query(
-			"SELECT column_name "
-			  "FROM information_schema.table_constraints, "
-			       "information_schema.key_column_usage "
-			 "WHERE information_schema.table_constraints.table_name = '" + table.name + "' AND "
-			       "information_schema.key_column_usage.table_name = information_schema.table_constraints.table_name AND "
-			       "constraint_type = 'PRIMARY KEY' "
-			 "ORDER BY ordinal_position",
-			primary_key_lister);
-
-		PostgreSQLKeyLister key_lister(table);
-		client.query(
-			"SELECT index_class.relname, pg_index.indisunique, attname, attnotnull "
-			  "FROM pg_class table_class, pg_index, pg_class index_class, generate_subscripts(indkey, 1) AS position, pg_attribute "
-			 "WHERE table_class.oid = pg_index.indrelid AND "
-			       "pg_index.indexrelid = index_class.oid AND index_class.relkind = 'i' AND "
-			       "table_class.oid = pg_attribute.attrelid AND pg_attribute.attnum = indkey[position] AND "
-			       "table_class.relname = '" + table.name + "' AND "
-			       "NOT pg_index.indisprimary "
-			 "ORDER BY relname, position",
-			key_lister);
-
-		// if the table has no primary key, we need to find a unique key with no nullable columns to act as a surrogate primary key
-		sort(table.keys.begin(), table.keys.end()); // order is arbitrary for keys, but both ends must be consistent, so we sort the keys by name
-		
-		for (Keys::const_iterator key = table.keys.begin(); key != table.keys.end() && table.primary_key_columns.empty(); ++key) {
-			if (key->unique && !key_lister.unique_but_nullable_keys.count(key->name)) {
-				table.primary_key_columns = key->columns;
-			}
-		}
-		if (table.primary_key_columns.empty()) {
-			// of course this falls apart if there are no unique keys, so we don't allow that
-			throw runtime_error("Couldn't find a primary or non-nullable unique key on table " + table.name);
-		}
-
+		table.estimated_size = row.int_at(1);
+		table.estimated_rows = row.int_at(2);
 		database.tables.push_back(table);
 	}
 
-	PostgreSQLClient &client;
 	Database &database;
 };
 
 void PostgreSQLClient::populate_database_schema(Database &database) {
-	PostgreSQLTableLister table_lister(*this, database);
-	query("SELECT tablename "
+	size_t first_table = database.tables.size();
+	PostgreSQLTableLister table_lister(database);
+	query("SELECT tablename, pg_total_relation_size(tablename::text), GREATEST(reltuples, 0)::int8 "
 		    "FROM pg_tables "
+		    "JOIN pg_class ON pg_class.oid = tablename::regclass "
 		   "WHERE schemaname = ANY (current_schemas(false)) "
 		   "ORDER BY pg_relation_size(tablename::text) DESC, tablename ASC",
 		  table_lister);
+
+	TablesByName tables_by_name;
+	for (size_t n = first_table; n < database.tables.size(); n++) {
+		tables_by_name[database.tables[n].name] = &database.tables[n];
+	}
+
+	// load the columns and keys of all the tables at once rather than querying the catalog for each table, which
+	// takes thousands of round trips on schemas with thousands of tables.  since we're in the read transaction, the
+	// catalog can't change under us between these queries.  we also note which columns' collations sort by their bytes;
+	// columns using the default collation get the database's.
+	string tables_in_schema("(SELECT tablename::regclass FROM pg_tables WHERE schemaname = ANY (current_schemas(false)))");
+	PostgreSQLColumnLister column_lister(tables_by_name);
+	query(
+		"SELECT relname, attname, format_type(atttypid, atttypmod), attnotnull, atthasdef, pg_get_expr(adbin, adrelid), "
+		       "COALESCE(CASE collname WHEN 'default' THEN (SELECT datcollate FROM pg_database WHERE datname = current_database()) ELSE collname END IN ('C', 'POSIX'), false) "
+		  "FROM pg_attribute "
+		  "JOIN pg_class ON attrelid = pg_class.oid "
+		  "JOIN pg_type ON atttypid = pg_type.oid "
+		  "LEFT JOIN pg_attrdef ON adrelid = attrelid AND adnum = attnum "
+		  "LEFT JOIN pg_collation ON attcollation = pg_collation.oid "
+		 "WHERE attnum > 0 AND "
+		       "NOT attisdropped AND "
+		       "pg_class.oid IN " + tables_in_schema + " "
+		 "ORDER BY relname, attnum",
+		column_lister);
+
+	PostgreSQLPrimaryKeyLister primary_key_lister(tables_by_name);
+	query(
+		"SELECT table_class.relname, attname "
+		  "FROM pg_class table_class, pg_index, generate_subscripts(indkey, 1) AS position, pg_attribute "
+		 "WHERE table_class.oid = pg_index.indrelid AND "
+		       "table_class.oid = pg_attribute.attrelid AND pg_attribute.attnum = indkey[position] AND "
+		       "table_class.oid IN " + tables_in_schema + " AND "
+		       "pg_index.indisprimary "
+		 "ORDER BY table_class.relname, position",
+		primary_key_lister);
+
+	PostgreSQLKeyLister key_lister(tables_by_name);
+	query(
+		"SELECT table_class.relname, index_class.relname, pg_index.indisunique, attname, attnotnull "
+		  "FROM pg_class table_class, pg_index, pg_class index_class, generate_subscripts(indkey, 1) AS position, pg_attribute "
+		 "WHERE table_class.oid = pg_index.indrelid AND "
+		       "pg_index.indexrelid = index_class.oid AND index_class.relkind = 'i' AND "
+		       "table_class.oid = pg_attribute.attrelid AND pg_attribute.attnum = indkey[position] AND "
+		       "table_class.oid IN " + tables_in_schema + " AND "
+		       "NOT pg_index.indisprimary "
+		 "ORDER BY table_class.relname, index_class.relname, position",
+		key_lister);
+
+	for (size_t n = first_table; n < database.tables.size(); n++) {
+		Table &table(database.tables[n]);
+
+		// if the table has no primary key, we need to find a unique key with no nullable columns to act as a surrogate primary key
+		sort(table.keys.begin(), table.keys.end()); // order is arbitrary for keys, but both ends must be consistent, so we sort the keys by name
+
+		const set<string> &unique_but_nullable_keys(key_lister.unique_but_nullable_keys[table.name]);
+		for (Keys::const_iterator key = table.keys.begin(); key != table.keys.end() && table.primary_key_columns.empty(); ++key) {
+			if (key->unique && !unique_but_nullable_keys.count(key->name)) {
+				table.primary_key_columns = key->columns;
+			}
+		}
+		if (table.primary_key_columns.empty()) {
+			// of course this falls apart if there are no unique keys, so we don't allow that
+			throw runtime_error("Couldn't find a primary or non-nullable unique key on table " + table.name);
+		}
+	}
 }
 
 
@@ -4,6 +4,7 @@
 #include "unistd.h"
 #include <cstdint>
 #include <cerrno>
+#include <cstring>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -155,15 +156,20 @@ inline Packer<Stream> &operator <<(Packer<Stream> &packer, const bool &obj) {
 
 template <typename Stream>
 inline Packer<Stream> &operator <<(Packer<Stream> &packer, const float &obj) {
+	// floating point values are written in network byte order like integers
+	uint32_t bits;
+	memcpy(&bits, &obj, sizeof(bits));
 	packer.write_bytes(MSGPACK_FLOAT);
-	packer.write_bytes(obj);
+	packer.write_bytes((uint32_t) htonl(bits));
 	return packer;
 }
 
 template <typename Stream>
 inline Packer<Stream> &operator <<(Packer<Stream> &packer, const double &obj) {
-	packer.write_bytes(MSGPACK_FLOAT);
-	packer.write_bytes(obj);
+	uint64_t bits;
+	memcpy(&bits, &obj, sizeof(bits));
+	packer.write_bytes(MSGPACK_DOUBLE);
+	packer.write_bytes((uint64_t) htonll(bits));
 	return packer;
 }
 
@@ -111,13 +111,21 @@ Unpacker<Stream> &operator >>(Unpacker<Stream> &unpacker, T &obj) {
 				obj = (T) true;
 				break;
 
-			case MSGPACK_FLOAT:
-				obj = (T) unpacker.template read_bytes<float>();
+			case MSGPACK_FLOAT: {
+				uint32_t bits = ntohl(unpacker.template read_bytes<uint32_t>());
+				float value;
+				memcpy(&value, &bits, sizeof(value));
+				obj = (T) value;
 				break;
+			}
 
-			case MSGPACK_DOUBLE:
-				obj = (T) unpacker.template read_bytes<double>();
+			case MSGPACK_DOUBLE: {
+				uint64_t bits = ntohll(unpacker.template read_bytes<uint64_t>());
+				double value;
+				memcpy(&value, &bits, sizeof(value));
+				obj = (T) value;
 				break;
+			}
 
 			case MSGPACK_UINT8:
 				obj = (T) unpacker.template read_bytes<uint8_t>();
@@ -8,7 +8,7 @@
 #include "db_url.h"
 
 struct Options {
-	inline Options(): workers(1), verbose(0), snapshot(true), alter(false), commit_level(CommitLevel::success) {}
+	inline Options(): workers(1), verbose(0), snapshot(true), alter(false), commit_level(CommitLevel::success), apply_in_background(false), progress(false) {}
 
 	void help() {
 		cerr <<
@@ -72,6 +72,30 @@ struct Options {
 			"                             for benchmarking and testing.  'often' is best if\n"
 			"                             you are happy to run Kitchen Sync again if it fails.\n"
 			"\n"
+			"  --apply-in-background      Apply changes at the 'to' end using a separate \n"
+			"                             thread for each worker, so that the worker can\n"
+			"                             carry on receiving rows and checking hashes (using\n"
+			"                             a second connection) while the previous batch is\n"
+			"                             written.  The amount of changes waiting to be\n"
+			"                             applied is limited, so memory use is still capped.\n"
+			"\n"
+			"  --progress                 Print a progress report every 10 seconds, showing\n"
+			"                             what each worker is working on, the rows\n"
+			"                             processed, and an estimate of the time remaining.\n"
+			"\n"
+			"  --metrics-file file.json   Write a report of the time each worker spent\n"
+			"                             reading, hashing, waiting for the other end,\n"
+			"                             applying changes and committing, plus the data\n"
+			"                             sent and received and the rows changed, for each\n"
+			"                             table and in total, to the given file.\n"
+			"\n"
+			"  --trace-file trace.json    Write a timeline of the commands sent and received,\n"
+			"                             database queries, network reads and writes, and\n"
+			"                             waits for other workers, in the Chrome trace\n"
+			"                             format.  Each 'from' process writes its own file,\n"
+			"                             named after this one with '.from-' and its process\n"
+			"                             ID appended.\n"
+			"\n"
 			"  --alter                    Alter the database schema if it doesn't match.\n"
 			"                             (If not given, the schema will still be checked,\n"
 			"                             and if it doesn't match the statements --alter\n"
@@ -101,6 +125,10 @@ struct Options {
 					{ "commit",						required_argument,	NULL,	'c' },
 					{ "partial",					no_argument,		NULL,	'p' }, // deprecated - use '--commit often' instead
 					{ "rollback-after",				no_argument,		NULL,	'r' }, // deprecated - use '--commit never', which is equivalent
+					{ "apply-in-background",		no_argument,		NULL,	'b' },
+					{ "metrics-file",				required_argument,	NULL,	'm' },
+					{ "progress",					no_argument,		NULL,	'P' },
+					{ "trace-file",					required_argument,	NULL,	'e' },
 					{ "alter",						no_argument,		NULL,	'a' },
 					{ "verbose",					no_argument,		NULL,	'V' },
 					{ "debug",						no_argument,		NULL,	'd' },
@@ -176,6 +204,22 @@ struct Options {
 						commit_level = CommitLevel::never;
 						break;
 
+					case 'b':
+						apply_in_background = true;
+						break;
+
+					case 'm':
+						metrics_file = optarg;
+						break;
+
+					case 'P':
+						progress = true;
+						break;
+
+					case 'e':
+						trace_file = optarg;
+						break;
+
 					case 'a':
 						alter = true;
 						break;
@@ -217,6 +261,10 @@ struct Options {
 	bool snapshot;
 	bool alter;
 	CommitLevel commit_level;
+	bool apply_in_background;
+	string metrics_file;
+	bool progress;
+	string trace_file;
 	string ignore, only;
 };
 
@@ -1,3 +1,6 @@
+#ifndef ROW_SERIALIZATION_H
+#define ROW_SERIALIZATION_H
+
 #ifdef __APPLE__
 	#include <CommonCrypto/CommonDigest.h>
 	#define MD5_CTX CC_MD5_CTX
@@ -9,6 +12,8 @@
 	#include <openssl/md5.h>
 #endif
 
+#include "canonical_values.h"
+
 struct RowCounter {
 	RowCounter(): row_count(0) {}
 
@@ -56,7 +61,7 @@ inline bool operator == (const Hash &hash, const string &str) {
 }
 
 struct RowHasher: RowCounter {
-	RowHasher(): size(0), row_packer(*this) {
+	RowHasher(const CanonicalForms &canonical_forms = CanonicalForms()): size(0), row_packer(*this), canonical_forms(canonical_forms) {
 		MD5_Init(&mdctx);
 	}
 
@@ -69,7 +74,11 @@ struct RowHasher: RowCounter {
 	template <typename DatabaseRow>
 	void operator()(const DatabaseRow &row) {
 		RowCounter::operator()(row);
-		row.pack_row_into(row_packer);
+		if (canonical_forms.empty()) {
+			row.pack_row_into(row_packer);
+		} else {
+			pack_canonical_row_into(row_packer, row, canonical_forms);
+		}
 	}
 
 	inline void write(const uint8_t *buf, size_t bytes) {
@@ -80,6 +89,7 @@ struct RowHasher: RowCounter {
 	MD5_CTX mdctx;
 	size_t size;
 	Packer<RowHasher> row_packer;
+	CanonicalForms canonical_forms;
 	Hash hash;
 };
 
@@ -102,7 +112,7 @@ struct RowLastKey {
 };
 
 struct RowHasherAndLastKey: RowHasher, RowLastKey {
-	RowHasherAndLastKey(const vector<size_t> &primary_key_columns): RowLastKey(primary_key_columns) {
+	RowHasherAndLastKey(const vector<size_t> &primary_key_columns, const CanonicalForms &canonical_forms = CanonicalForms()): RowHasher(canonical_forms), RowLastKey(primary_key_columns) {
 	}
 
 	template <typename DatabaseRow>
@@ -123,3 +133,5 @@ struct RowPackerAndLastKey: RowPacker<OutputStream>, RowLastKey {
 		RowLastKey::operator()(row);
 	}
 };
+
+#endif
@@ -43,11 +43,12 @@ struct Column {
 	DefaultType default_type;
 	string default_value;
 
-	// the following member isn't serialized currently (could be, but not required):
+	// the following members aren't serialized currently (could be, but not required):
 	string filter_expression;
+	bool binary_collation; // the column's collation already compares string values by their bytes
 
-	inline Column(const string &name, bool nullable, DefaultType default_type, string default_value, string column_type, size_t size = 0, size_t scale = 0): name(name), nullable(nullable), default_type(default_type), default_value(default_value), column_type(column_type), size(size), scale(scale) {}
-	inline Column(): nullable(true), size(0), scale(0), default_type(DefaultType::no_default) {}
+	inline Column(const string &name, bool nullable, DefaultType default_type, string default_value, string column_type, size_t size = 0, size_t scale = 0): name(name), nullable(nullable), default_type(default_type), default_value(default_value), column_type(column_type), size(size), scale(scale), binary_collation(false) {}
+	inline Column(): nullable(true), size(0), scale(0), default_type(DefaultType::no_default), binary_collation(false) {}
 
 	inline bool operator ==(const Column &other) const { return (name == other.name && nullable == other.nullable && column_type == other.column_type && size == other.size && scale == other.scale && default_type == other.default_type && default_value == other.default_value); }
 	inline bool operator !=(const Column &other) const { return (!(*this == other)); }
@@ -77,11 +78,14 @@ struct Table {
 	ColumnIndices primary_key_columns;
 	Keys keys;
 
-	// the following member isn't serialized currently (could be, but not required):
+	// the following members aren't serialized currently (could be, but not required):
 	string where_conditions;
+	uint64_t estimated_size; // bytes used by the table and its keys, according to the database's statistics
+	uint64_t estimated_rows; // likewise, the number of rows
+	bool binary_key_order; // compare and order string key columns by their bytes rather than the column's collation
 
-	inline Table(const string &name): name(name) {}
-	inline Table() {}
+	inline Table(const string &name): name(name), estimated_size(0), estimated_rows(0), binary_key_order(false) {}
+	inline Table(): estimated_size(0), estimated_rows(0), binary_key_order(false) {}
 
 	inline bool operator <(const Table &other) const { return (name < other.name); }
 	inline bool operator ==(const Table &other) const { return (name == other.name && columns == other.columns && primary_key_columns == other.primary_key_columns && keys == other.keys); }
@@ -3,6 +3,9 @@
 
 #include <algorithm>
 #include <list>
+#include <map>
+#include <set>
+#include <vector>
 
 #include "database_client_traits.h"
 #include "schema.h"
@@ -36,8 +39,9 @@ struct DropKeyStatements <DatabaseClient, true> {
 
 template <typename DatabaseClient>
 struct CreateKeyStatements {
-	static void add_to(Statements &statements, DatabaseClient &client, const Table &table, const Key &key) {
+	static void add_to(Statements &statements, DatabaseClient &client, const Table &table, const Key &key, bool concurrently = false) {
 		string result(key.unique ? "CREATE UNIQUE INDEX " : "CREATE INDEX ");
+		if (concurrently) result += "CONCURRENTLY ";
 		result += client.quote_identifiers_with();
 		result += key.name;
 		result += client.quote_identifiers_with();
@@ -348,6 +352,18 @@ struct AddColumnClauses<DatabaseClient, true> {
 	}
 };
 
+// the statements for different tables can be run concurrently, except where key names are global to the database,
+// where a key may need to be dropped from one table before another table's key can take its name
+template <typename DatabaseClient, bool = is_base_of<GlobalKeys, DatabaseClient>::value>
+struct KeyNameScope {
+	static string key_name_in_scope(const Table &table, const Key &key) { return table.name + '.' + key.name; }
+};
+
+template <typename DatabaseClient>
+struct KeyNameScope <DatabaseClient, true> {
+	static string key_name_in_scope(const Table &table, const Key &key) { return key.name; }
+};
+
 template <typename DatabaseClient>
 struct SchemaMatcher {
 	SchemaMatcher(DatabaseClient &client): client(client) {}
@@ -366,32 +382,74 @@ struct SchemaMatcher {
 		Tables::iterator from_table = from_tables.begin();
 		Tables::iterator   to_table =   to_tables.begin();
 		while (to_table != to_tables.end()) {
+			Statements table_statements;
+			set<string> key_names;
+
 			if (from_table == from_tables.end() ||
 				from_table->name > to_table->name) {
 				// our end has an extra table, drop it
-				DropTableStatements<DatabaseClient>::add_to(statements, client, *to_table);
+				add_key_names(key_names, *to_table);
+				DropTableStatements<DatabaseClient>::add_to(table_statements, client, *to_table);
 				to_table = to_tables.erase(to_table);
 				// keep the current from_table and re-evaluate on the next iteration
 
 			} else if (to_table->name > from_table->name) {
-				CreateTableStatements<DatabaseClient>::add_to(statements, client, *from_table);
+				add_key_names(key_names, *from_table);
+				CreateTableStatements<DatabaseClient>::add_to(table_statements, client, *from_table);
 				to_table = ++to_tables.insert(to_table, *from_table);
 				++from_table;
 
 			} else {
-				match_table(*from_table, *to_table);
+				add_key_names(key_names, *from_table);
+				add_key_names(key_names, *to_table);
+				match_table(table_statements, *from_table, *to_table);
 				++to_table;
 				++from_table;
 			}
+
+			add_table_statements(table_statements, key_names);
 		}
 		while (from_table != from_tables.end()) {
-			CreateTableStatements<DatabaseClient>::add_to(statements, client, *from_table);
+			Statements table_statements;
+			set<string> key_names;
+			add_key_names(key_names, *from_table);
+			CreateTableStatements<DatabaseClient>::add_to(table_statements, client, *from_table);
 			to_tables.push_back(*from_table);
 			++from_table;
+			add_table_statements(table_statements, key_names);
 		}
 	}
 
-	void match_table(Table &from_table, Table &to_table) {
+	void add_key_names(set<string> &key_names, const Table &table) {
+		for (const Key &key : table.keys) {
+			key_names.insert(KeyNameScope<DatabaseClient>::key_name_in_scope(table, key));
+		}
+	}
+
+	void add_table_statements(Statements &table_statements, const set<string> &key_names) {
+		if (table_statements.empty()) return;
+		statements.insert(statements.end(), table_statements.begin(), table_statements.end());
+
+		// start a new group for the table, unless its keys share names with keys in other groups, in which case we
+		// merge those groups into this one.  each group's statements stay in their original order, and this table's
+		// come after all of them, which is all that the dependencies between them need.
+		size_t group = statement_groups.size();
+		statement_groups.push_back(Statements());
+		for (const string &key_name : key_names) {
+			map<string, size_t>::iterator existing = group_using_key_name.find(key_name);
+			if (existing != group_using_key_name.end() && existing->second != group && !statement_groups[existing->second].empty()) {
+				size_t merged_group = existing->second;
+				statement_groups[group].splice(statement_groups[group].end(), statement_groups[merged_group]);
+				for (pair<const string, size_t> &entry : group_using_key_name) {
+					if (entry.second == merged_group) entry.second = group;
+				}
+			}
+			group_using_key_name[key_name] = group;
+		}
+		statement_groups[group].splice(statement_groups[group].end(), table_statements);
+	}
+
+	void match_table(Statements &statements, Table &from_table, Table &to_table) {
 		// sort the key lists so they have the same order; we consider keys to be unordered
 		sort(from_table.keys.begin(), from_table.keys.end());
 		sort(  to_table.keys.begin(),   to_table.keys.end());
@@ -536,6 +594,11 @@ struct SchemaMatcher {
 
 	DatabaseClient &client;
 	Statements statements;
+
+	// the same statements, grouped so that the statements in different groups can be run concurrently.  some groups
+	// may be empty, having been merged into a later group.
+	vector<Statements> statement_groups;
+	map<string, size_t> group_using_key_name;
 };
 
 #endif
@@ -29,6 +29,44 @@ string columns_list(DatabaseClient &client, const Columns &columns, const Column
 	return result;
 }
 
+// the databases order string keys by their collation, which may differ between the two ends if they are different
+// database servers, in which case the same key range or LIMIT would cover different rows at each end and the hashes
+// would never match.  when both ends agree to, they compare and order string keys by their bytes instead.  that
+// stops the database using the key's index, so we only do it for columns whose collation doesn't already sort that way.
+inline bool binary_ordered_key_column(const Table &table, const Column &column) {
+	return (table.binary_key_order && !column.binary_collation &&
+		(column.column_type == ColumnTypes::VCHR || column.column_type == ColumnTypes::FCHR || column.column_type == ColumnTypes::TEXT));
+}
+
+template <typename DatabaseClient>
+string key_column_sql(DatabaseClient &client, const Table &table, size_t column_index, bool qualified) {
+	const Column &column(table.columns[column_index]);
+	string result;
+	if (qualified) {
+		result += table.name;
+		result += '.';
+	}
+	result += client.quote_identifiers_with();
+	result += column.name;
+	result += client.quote_identifiers_with();
+	return binary_ordered_key_column(table, column) ? client.binary_collated(result) : result;
+}
+
+template <typename DatabaseClient>
+string key_columns_list(DatabaseClient &client, const Table &table) {
+	if (table.primary_key_columns.empty()) {
+		return "(NULL)";
+	}
+
+	string result("(");
+	for (ColumnIndices::const_iterator column_index = table.primary_key_columns.begin(); column_index != table.primary_key_columns.end(); ++column_index) {
+		if (column_index != table.primary_key_columns.begin()) result += ", ";
+		result += key_column_sql(client, table, *column_index, false);
+	}
+	result += ")";
+	return result;
+}
+
 template <typename DatabaseClient>
 string values_list(DatabaseClient &client, const Table &table, const ColumnValues &values) {
 	if (values.empty()) {
@@ -40,28 +78,42 @@ string values_list(DatabaseClient &client, const Table &table, const ColumnValue
 		if (n > 0) {
 			result += ',';
 		}
-		result += encode(client, table.columns[table.primary_key_columns[n]], values[n]);
+		append_encoded(client, result, table.columns[table.primary_key_columns[n]], values[n]);
 	}
 	result += ")";
 	return result;
 }
 
 template <typename DatabaseClient>
-string where_sql(DatabaseClient &client, const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key, const string &extra_where_conditions = "", const char *prefix = " WHERE ") {
-	string key_columns(columns_list(client, table.columns, table.primary_key_columns));
+string parameters_list(DatabaseClient &client, const Table &table, size_t &parameter_number) {
+	string result("(");
+	for (size_t n = 0; n < table.primary_key_columns.size(); n++) {
+		if (n > 0) {
+			result += ',';
+		}
+		result += client.parameter_placeholder(++parameter_number);
+	}
+	result += ")";
+	return result;
+}
+
+// the key range conditions are given as already-encoded value lists or parameter lists; an empty string means no bound
+template <typename DatabaseClient>
+string key_range_sql(DatabaseClient &client, const Table &table, const string &prev_key_sql, const string &last_key_sql, const string &extra_where_conditions = "", const char *prefix = " WHERE ") {
+	string key_columns(key_columns_list(client, table));
 	string result;
-	if (!prev_key.empty()) {
+	if (!prev_key_sql.empty()) {
 		result += prefix;
 		result += key_columns;
 		result += " > ";
-		result += values_list(client, table, prev_key);
+		result += prev_key_sql;
 		prefix = " AND ";
 	}
-	if (!last_key.empty()) {
+	if (!last_key_sql.empty()) {
 		result += prefix;
 		result += key_columns;
 		result += " <= ";
-		result += values_list(client, table, last_key);
+		result += last_key_sql;
 		prefix = " AND ";
 	}
 	if (!extra_where_conditions.empty()) {
@@ -71,6 +123,21 @@ string where_sql(DatabaseClient &client, const Table &table, const ColumnValues
 	return result;
 }
 
+template <typename DatabaseClient>
+string where_sql(DatabaseClient &client, const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key, const string &extra_where_conditions = "", const char *prefix = " WHERE ") {
+	return key_range_sql(client, table,
+		prev_key.empty() ? string() : values_list(client, table, prev_key),
+		last_key.empty() ? string() : values_list(client, table, last_key),
+		extra_where_conditions, prefix);
+}
+
+template <typename DatabaseClient>
+string where_parameters_sql(DatabaseClient &client, const Table &table, bool prev_key, bool last_key, size_t &parameter_number) {
+	string prev_key_sql(prev_key ? parameters_list(client, table, parameter_number) : string());
+	string last_key_sql(last_key ? parameters_list(client, table, parameter_number) : string());
+	return key_range_sql(client, table, prev_key_sql, last_key_sql, table.where_conditions);
+}
+
 template <typename DatabaseClient>
 string select_columns_sql(DatabaseClient &client, const Table &table) {
 	string result;
@@ -90,21 +157,34 @@ string select_columns_sql(DatabaseClient &client, const Table &table) {
 const ssize_t NO_ROW_COUNT_LIMIT = -1;
 
 template <typename DatabaseClient>
-string retrieve_rows_sql(DatabaseClient &client, const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key, ssize_t row_count = NO_ROW_COUNT_LIMIT) {
-	string key_columns(columns_list(client, table.columns, table.primary_key_columns));
-
+string select_rows_sql(DatabaseClient &client, const Table &table, const string &select_columns, const string &where_sql, const string &limit_sql) {
 	string result("SELECT ");
-	result += select_columns_sql(client, table);
+	result += select_columns;
 	result += " FROM ";
 	result += table.name;
-	result += where_sql(client, table, prev_key, last_key, table.where_conditions);
-	result += " ORDER BY " + key_columns.substr(1, key_columns.size() - 2);
-	if (row_count != NO_ROW_COUNT_LIMIT) {
-		result += " LIMIT " + to_string(row_count);
+	result += where_sql;
+
+	// the key columns are qualified with the table name so that we order by the actual column values even if
+	// the select list has replaced them with expressions or conversions of the same name
+	result += " ORDER BY ";
+	for (ColumnIndices::const_iterator column_index = table.primary_key_columns.begin(); column_index != table.primary_key_columns.end(); ++column_index) {
+		if (column_index != table.primary_key_columns.begin()) result += ", ";
+		result += key_column_sql(client, table, *column_index, true);
+	}
+
+	if (!limit_sql.empty()) {
+		result += " LIMIT " + limit_sql;
 	}
 	return result;
 }
 
+template <typename DatabaseClient>
+string retrieve_rows_sql(DatabaseClient &client, const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key, ssize_t row_count = NO_ROW_COUNT_LIMIT) {
+	return select_rows_sql(client, table, select_columns_sql(client, table),
+		where_sql(client, table, prev_key, last_key, table.where_conditions),
+		row_count == NO_ROW_COUNT_LIMIT ? string() : to_string(row_count));
+}
+
 template <typename DatabaseClient>
 string count_rows_sql(DatabaseClient &client, const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key) {
 	string result("SELECT COUNT(*) FROM ");
@@ -113,4 +193,39 @@ string count_rows_sql(DatabaseClient &client, const Table &table, const ColumnVa
 	return result;
 }
 
+// selects only the key of the row the given number of rows into the range, so that we can find where to divide up
+// a large range without reading all the rows before that point
+template <typename DatabaseClient>
+string key_after_rows_sql(DatabaseClient &client, const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key, size_t rows) {
+	string key_columns;
+	for (ColumnIndices::const_iterator column_index = table.primary_key_columns.begin(); column_index != table.primary_key_columns.end(); ++column_index) {
+		if (column_index != table.primary_key_columns.begin()) key_columns += ", ";
+		key_columns += client.quote_identifiers_with();
+		key_columns += table.columns[*column_index].name;
+		key_columns += client.quote_identifiers_with();
+	}
+	return select_rows_sql(client, table, key_columns,
+		where_sql(client, table, prev_key, last_key, table.where_conditions),
+		"1 OFFSET " + to_string(rows - 1));
+}
+
+// parameterized versions of the above for use with prepared statements; the key values are bound in order (prev_key
+// columns, then last_key columns, then the row count), and only the key bounds and limit that are present are included.
+// the client may give its own select list, for example to convert columns to the representation it wants to receive.
+template <typename DatabaseClient>
+string retrieve_rows_parameterized_sql(DatabaseClient &client, const Table &table, const string &select_columns, bool prev_key, bool last_key, bool row_count) {
+	size_t parameter_number = 0;
+	string where(where_parameters_sql(client, table, prev_key, last_key, parameter_number));
+	return select_rows_sql(client, table, select_columns, where, row_count ? client.parameter_placeholder(++parameter_number) : string());
+}
+
+template <typename DatabaseClient>
+string count_rows_parameterized_sql(DatabaseClient &client, const Table &table, bool prev_key, bool last_key) {
+	size_t parameter_number = 0;
+	string result("SELECT COUNT(*) FROM ");
+	result += table.name;
+	result += where_parameters_sql(client, table, prev_key, last_key, parameter_number);
+	return result;
+}
+
 #endif
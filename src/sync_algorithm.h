@@ -9,16 +9,24 @@ struct sync_error: public runtime_error {
 	sync_error(): runtime_error("Sync error") { }
 };
 
+// from protocol version 8, both ends hash the canonical form of values that different databases format differently
+template <typename Worker>
+inline CanonicalForms hash_canonical_forms(const Worker &worker, const Table &table) {
+	return (worker.protocol_version >= 8 ? canonical_forms_of(table.columns) : CanonicalForms());
+}
+
 template <typename Worker>
 void check_hash_and_choose_next_range(Worker &worker, const Table &table, const ColumnValues *failed_prev_key, const ColumnValues &prev_key, const ColumnValues &last_key, const ColumnValues *failed_last_key, const string &hash, size_t target_block_size) {
 	if (hash.empty()) throw logic_error("No hash to check given");
 	if (last_key.empty()) throw logic_error("No range end given");
 
 	// the other end has given us their hash for the key range (prev_key, last_key], calculate our hash
-	RowHasher hasher;
-	worker.client.retrieve_rows(hasher, table, prev_key, last_key);
+	RowHasher hasher(hash_canonical_forms(worker, table));
+	worker.retrieve_rows(hasher, table, prev_key, last_key);
+	bool matched = (hasher.finish() == hash);
+	worker.range_hashed(hasher.row_count, matched);
 
-	if (hasher.finish() == hash) {
+	if (matched) {
 		if (failed_prev_key) {
 			// send the previously-requested rows - since there's a span of successful rows after
 			// it, we don't want to combine the next hash command.
@@ -31,7 +39,7 @@ void check_hash_and_choose_next_range(Worker &worker, const Table &table, const
 		} else {
 			// this range matched but somewhere > last_key & <= failed_last_key there is a mismatch,
 			// so count how many rows we should use to subdivide that range.
-			size_t rows_to_failure = worker.client.count_rows(table, last_key, *failed_last_key);
+			size_t rows_to_failure = worker.count_rows(table, last_key, *failed_last_key);
 
 			// check if there's enough in that range (0 or 1 row(s), or less than target_block_size
 			// bytes of data) on our side to bother subdividing and trying the shorter range.
@@ -68,7 +76,7 @@ template <typename Worker, typename Hasher>
 void hash_to_target_block_size(Worker &worker, const Table &table, Hasher &hasher, size_t target_block_size) {
 	if (hasher.size == 0) return;
 	while (hasher.size <= target_block_size/2 &&
-		   worker.client.retrieve_rows(hasher, table, hasher.last_key, ColumnValues(), max<size_t>((target_block_size/2 - hasher.size)*hasher.row_count/hasher.size, 1)))
+		   worker.retrieve_rows(hasher, table, hasher.last_key, ColumnValues(), max<size_t>((target_block_size/2 - hasher.size)*hasher.row_count/hasher.size, 1)))
 		/* continue */;
 }
 
@@ -76,8 +84,8 @@ template <typename Worker>
 void hash_failed_range(Worker &worker, const Table &table, size_t rows_to_hash, const ColumnValues *failed_prev_key, const ColumnValues &prev_key, const ColumnValues &failed_last_key) {
 	if (!rows_to_hash) throw logic_error("Can't hash 0 rows");
 
-	RowHasherAndLastKey hasher(table.primary_key_columns);
-	worker.client.retrieve_rows(hasher, table, prev_key, ColumnValues(), rows_to_hash);
+	RowHasherAndLastKey hasher(table.primary_key_columns, hash_canonical_forms(worker, table));
+	worker.retrieve_rows(hasher, table, prev_key, ColumnValues(), rows_to_hash);
 
 	if (failed_prev_key) {
 		worker.send_rows_and_hash_fail_command(table, *failed_prev_key, prev_key, hasher.last_key, failed_last_key, hasher.finish().to_string());
@@ -90,8 +98,8 @@ template <typename Worker>
 void hash_next_range(Worker &worker, const Table &table, const ColumnValues &prev_key, size_t rows_to_hash, size_t target_block_size) {
 	if (!rows_to_hash) throw logic_error("Can't hash 0 rows");
 	
-	RowHasherAndLastKey hasher(table.primary_key_columns);
-	worker.client.retrieve_rows(hasher, table, prev_key, ColumnValues(), rows_to_hash);
+	RowHasherAndLastKey hasher(table.primary_key_columns, hash_canonical_forms(worker, table));
+	worker.retrieve_rows(hasher, table, prev_key, ColumnValues(), rows_to_hash);
 	hash_to_target_block_size(worker, table, hasher, target_block_size);
 
 	if (hasher.row_count == 0) {
@@ -117,7 +125,7 @@ void rows_and_next_hash(Worker &worker, const Table &table, const ColumnValues &
 	// (the hypothetical key value before that row's would be preferrable if we could find it).
 	if (extend_last_key && !last_key.empty()) {
 		RowLastKey row_last_key(table.primary_key_columns);
-		worker.client.retrieve_rows(row_last_key, table, last_key, ColumnValues(), 1);
+		worker.retrieve_rows(row_last_key, table, last_key, ColumnValues(), 1);
 		last_key = row_last_key.last_key; // may still be empty if we have no more rows
 	}
 
@@ -129,8 +137,8 @@ void rows_and_next_hash(Worker &worker, const Table &table, const ColumnValues &
 		worker.send_rows_command(table, prev_key, last_key /* will be [] */);
 	} else {
 		// find the hash for the range *after* the rows that we will send
-		RowHasherAndLastKey hasher(table.primary_key_columns);
-		worker.client.retrieve_rows(hasher, table, last_key, ColumnValues(), 1 /* rows to hash */);
+		RowHasherAndLastKey hasher(table.primary_key_columns, hash_canonical_forms(worker, table));
+		worker.retrieve_rows(hasher, table, last_key, ColumnValues(), 1 /* rows to hash */);
 
 		// hash more rows if we're not even close to the target block size, so we don't spend
 		// forever trading hashes and rows for small ranges if most of the table doesn't match
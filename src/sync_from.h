@@ -3,6 +3,7 @@
 #include "filters.h"
 #include "fdstream.h"
 #include "sync_algorithm.h"
+#include "sql_functions.h"
 
 template<class DatabaseClient>
 struct SyncFromWorker {
@@ -11,6 +12,7 @@ struct SyncFromWorker {
 		const string &set_variables, const string &filter_file,
 		int read_from_descriptor, int write_to_descriptor, char *status_area, size_t status_size):
 			client(database_host, database_port, database_name, database_username, database_password),
+			schema_populated(false),
 			filter_file(filter_file),
 			in(read_from_descriptor),
 			input(in),
@@ -18,6 +20,9 @@ struct SyncFromWorker {
 			output(out),
 			status_area(status_area),
 			status_size(status_size),
+			status_updated(0),
+			rows_processed(0),
+			binary_key_order(false),
 			target_block_size(1) {
 		if (!set_variables.empty()) {
 			client.execute("SET " + set_variables);
@@ -35,12 +40,21 @@ struct SyncFromWorker {
 			while (true) {
 				verb_t verb;
 				input >> verb;
+				TraceScope trace("command", command_name(verb));
 
 				switch (verb) {
 					case Commands::OPEN:
 						table = handle_open_command();
 						break;
 
+					case Commands::SELECT_TABLE:
+						table = handle_select_table_command();
+						break;
+
+					case Commands::END_KEY:
+						handle_end_key_command(table);
+						break;
+
 					case Commands::HASH_NEXT:
 						handle_hash_next_command(table);
 						break;
@@ -85,6 +99,10 @@ struct SyncFromWorker {
 						handle_target_block_size_command();
 						break;
 
+					case Commands::BINARY_KEY_ORDER:
+						handle_binary_key_order_command();
+						break;
+
 					case Commands::QUIT:
 						read_all_arguments(input);
 						return;
@@ -105,17 +123,40 @@ struct SyncFromWorker {
 	const Table *handle_open_command() {
 		string table_name;
 		read_all_arguments(input, table_name);
+		const Table *table = select_table(table_name);
+		hash_first_range(*this, *table, target_block_size);
+		return table;
+	}
+
+	const Table *handle_select_table_command() {
+		// like open, but doesn't start hashing; the other end will follow up with the command it wants
+		string table_name;
+		read_all_arguments(input, table_name);
+		return select_table(table_name);
+	}
+
+	const Table *select_table(const string &table_name) {
+		populate_database_schema();
 		const Table *table = tables_by_name.at(table_name); // throws out_of_range if not present in the map
+		end_key.clear();
+		rows_processed = 0;
 		show_status("syncing " + table_name);
-		hash_first_range(*this, *table, target_block_size);
 		return table;
 	}
 
+	void handle_end_key_command(const Table *table) {
+		// the rest of the table after the given key is being handled by another worker, so from now on we treat it
+		// as the end of the table; no response is sent
+		if (!table) throw command_error("Expected a table command before end key command");
+		read_all_arguments(input, end_key);
+	}
+
 	void handle_hash_next_command(const Table *table) {
 		if (!table) throw command_error("Expected a table command before hash command");
 		ColumnValues prev_key, last_key;
 		string hash;
 		read_all_arguments(input, prev_key, last_key, hash);
+		show_progress(*table, last_key);
 		check_hash_and_choose_next_range(*this, *table, nullptr, prev_key, last_key, nullptr, hash, target_block_size);
 	}
 
@@ -124,6 +165,7 @@ struct SyncFromWorker {
 		ColumnValues prev_key, last_key, failed_last_key;
 		string hash;
 		read_all_arguments(input, prev_key, last_key, failed_last_key, hash);
+		show_progress(*table, failed_last_key);
 		check_hash_and_choose_next_range(*this, *table, nullptr, prev_key, last_key, &failed_last_key, hash, target_block_size);
 	}
 
@@ -131,6 +173,7 @@ struct SyncFromWorker {
 		if (!table) throw command_error("Expected a table command before rows command");
 		ColumnValues prev_key, last_key;
 		read_all_arguments(input, prev_key, last_key);
+		show_progress(*table, last_key);
 		send_rows_command(*table, prev_key, last_key);
 	}
 
@@ -139,6 +182,7 @@ struct SyncFromWorker {
 		ColumnValues prev_key, last_key, next_key;
 		string hash;
 		read_all_arguments(input, prev_key, last_key, next_key, hash);
+		show_progress(*table, next_key);
 		check_hash_and_choose_next_range(*this, *table, &prev_key, last_key, next_key, nullptr, hash, target_block_size);
 	}
 
@@ -147,13 +191,13 @@ struct SyncFromWorker {
 		ColumnValues prev_key, last_key, next_key, failed_last_key;
 		string hash;
 		read_all_arguments(input, prev_key, last_key, next_key, failed_last_key, hash);
+		show_progress(*table, failed_last_key);
 		check_hash_and_choose_next_range(*this, *table, &prev_key, last_key, next_key, &failed_last_key, hash, target_block_size);
 	}
 
 	void handle_export_snapshot_command() {
 		read_all_arguments(input);
 		send_command(output, Commands::EXPORT_SNAPSHOT, client.export_snapshot());
-		populate_database_schema();
 	}
 
 	void handle_import_snapshot_command() {
@@ -161,7 +205,6 @@ struct SyncFromWorker {
 		read_all_arguments(input, snapshot);
 		client.import_snapshot(snapshot);
 		send_command(output, Commands::IMPORT_SNAPSHOT); // just to indicate that we have completed the command
-		populate_database_schema();
 	}
 
 	void handle_unhold_snapshot_command() {
@@ -174,11 +217,11 @@ struct SyncFromWorker {
 		read_all_arguments(input);
 		client.start_read_transaction();
 		send_command(output, Commands::WITHOUT_SNAPSHOT); // just to indicate that we have completed the command
-		populate_database_schema();
 	}
 
 	void handle_schema_command() {
 		read_all_arguments(input);
+		populate_database_schema();
 		send_command(output, Commands::SCHEMA, database);
 	}
 
@@ -187,11 +230,21 @@ struct SyncFromWorker {
 		send_command(output, Commands::TARGET_BLOCK_SIZE, target_block_size); // we always accept the requested size and send it back (but the test suite doesn't)
 	}
 
-	inline void send_hash_next_command(const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key, const string &hash) {
+	void handle_binary_key_order_command() {
+		// the other end is a different type of database, so we both need to order string keys by their bytes
+		read_all_arguments(input);
+		binary_key_order = true;
+		for (Table &table : database.tables) {
+			table.binary_key_order = true;
+		}
+		send_command(output, Commands::BINARY_KEY_ORDER); // just to indicate that we have completed the command
+	}
+
+	inline void send_hash_next_command(const Table &, const ColumnValues &prev_key, const ColumnValues &last_key, const string &hash) {
 		send_command(output, Commands::HASH_NEXT, prev_key, last_key, hash);
 	}
 
-	inline void send_hash_fail_command(const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key, const ColumnValues &failed_last_key, const string &hash) {
+	inline void send_hash_fail_command(const Table &, const ColumnValues &prev_key, const ColumnValues &last_key, const ColumnValues &failed_last_key, const string &hash) {
 		send_command(output, Commands::HASH_FAIL, prev_key, last_key, failed_last_key, hash);
 	}
 
@@ -220,7 +273,8 @@ struct SyncFromWorker {
 		RowPackerAndLastKey<FDWriteStream> row_packer(output, table.primary_key_columns);
 
 		while (true) {
-			client.retrieve_rows(row_packer, table, prev_key, last_key, BATCH_SIZE);
+			retrieve_rows(row_packer, table, prev_key, last_key, BATCH_SIZE);
+			rows_processed += row_packer.row_count;
 			if (row_packer.row_count < BATCH_SIZE) break;
 			prev_key = row_packer.last_key;
 			row_packer.reset_row_count();
@@ -229,7 +283,7 @@ struct SyncFromWorker {
 
 	void negotiate_protocol_version() {
 		const int EARLIEST_PROTOCOL_VERSION_SUPPORTED = 5;
-		const int LATEST_PROTOCOL_VERSION_SUPPORTED = 5;
+		const int LATEST_PROTOCOL_VERSION_SUPPORTED = 9;
 
 		// all conversations must start with a Commands::PROTOCOL command to establish the language to be used
 		int their_protocol_version;
@@ -243,15 +297,55 @@ struct SyncFromWorker {
 	}
 
 	void populate_database_schema() {
+		// we load the schema when it's first needed - when the leader's peer asks for it, or when any worker is
+		// asked for its first table - rather than when the snapshot is started, since on mysql other connections
+		// can't commit while the workers are starting their snapshots, and loading the catalog can take a while.
+		// only the leader's peer asks for the schema, but the other workers need the table definitions too.
+		if (schema_populated) return;
 		client.populate_database_schema(database);
 
 		for (Table &table : database.tables) {
+			table.binary_key_order = binary_key_order;
 			tables_by_name[table.name] = &table;
 		}
 
 		if (!filter_file.empty()) {
 			load_filters(filter_file, tables_by_name);
 		}
+
+		schema_populated = true;
+	}
+
+	template <typename RowReceiver>
+	inline size_t retrieve_rows(RowReceiver &row_receiver, const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key, ssize_t row_count = NO_ROW_COUNT_LIMIT) {
+		// an empty last_key means the end of the range we're working on, which is the end of the table unless the other
+		// end has told us otherwise
+		TraceScope trace("db", "retrieve_rows", table.name);
+		return client.retrieve_rows(row_receiver, table, prev_key, last_key.empty() ? end_key : last_key, row_count);
+	}
+
+	inline size_t count_rows(const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key) {
+		TraceScope trace("db", "count_rows", table.name);
+		return client.count_rows(table, prev_key, last_key.empty() ? end_key : last_key);
+	}
+
+	inline void range_hashed(size_t rows, bool matched) {
+		// rows in ranges that didn't match will be counted when they're hashed again or sent
+		if (matched) rows_processed += rows;
+	}
+
+	void show_progress(const Table &table, const ColumnValues &last_key_in_play) {
+		// there can be many commands a second, so we only update the status area occasionally
+		time_t now = time(nullptr);
+		if (now == status_updated) return;
+		status_updated = now;
+
+		string status("syncing " + table.name);
+		if (!last_key_in_play.empty()) status += " at " + values_list(client, table, last_key_in_play);
+		status += ", " + to_string(rows_processed);
+		if (table.estimated_rows) status += " of ~" + to_string(table.estimated_rows);
+		status += " rows, " + to_string(out.bytes_written/1048576) + " MB sent";
+		show_status(status);
 	}
 
 	void show_status(string message) {
@@ -261,6 +355,7 @@ struct SyncFromWorker {
 
 	DatabaseClient client;
 	Database database;
+	bool schema_populated;
 	map<string, Table*> tables_by_name;
 	string filter_file;
 	FDReadStream in;
@@ -269,9 +364,13 @@ struct SyncFromWorker {
 	Packer<FDWriteStream> output;
 	char *status_area;
 	size_t status_size;
+	time_t status_updated;
+	uint64_t rows_processed;
+	bool binary_key_order;
 
 	int protocol_version;
 	size_t target_block_size;
+	ColumnValues end_key;
 };
 
 template<class DatabaseClient, typename... Options>
@@ -0,0 +1,87 @@
+#include "sync_metrics.h"
+#include "json_string.h"
+
+#include <iomanip>
+
+RangeSizeHistogram &RangeSizeHistogram::operator +=(const RangeSizeHistogram &other) {
+	if (counts.size() < other.counts.size()) counts.resize(other.counts.size());
+	for (size_t bucket = 0; bucket < other.counts.size(); bucket++) {
+		counts[bucket] += other.counts[bucket];
+	}
+	return *this;
+}
+
+SyncMetrics &SyncMetrics::operator +=(const SyncMetrics &other) {
+	// elapsed time isn't additive; the worker's totals keep their own
+	bytes_sent += other.bytes_sent;
+	bytes_received += other.bytes_received;
+	round_trips += other.round_trips;
+	hash_commands += other.hash_commands;
+	rows_commands += other.rows_commands;
+	read_seconds += other.read_seconds;
+	hash_seconds += other.hash_seconds;
+	network_wait_seconds += other.network_wait_seconds;
+	apply_seconds += other.apply_seconds;
+	commit_seconds += other.commit_seconds;
+	rows_inserted += other.rows_inserted;
+	rows_updated += other.rows_updated;
+	rows_deleted += other.rows_deleted;
+	range_deletes += other.range_deletes;
+	tables_analyzed += other.tables_analyzed;
+	analyze_seconds += other.analyze_seconds;
+	hashed_ranges += other.hashed_ranges;
+	rows_ranges += other.rows_ranges;
+	return *this;
+}
+
+static void write_histogram(ostream &os, const RangeSizeHistogram &histogram) {
+	os << '[';
+	for (size_t bucket = 0; bucket < histogram.counts.size(); bucket++) {
+		if (bucket) os << ", ";
+		os << histogram.counts[bucket];
+	}
+	os << ']';
+}
+
+static void write_metrics(ostream &os, const SyncMetrics &metrics, const string &indent) {
+	os << indent << "\"elapsed_seconds\": " << metrics.elapsed_seconds << ",\n"
+	   << indent << "\"bytes_sent\": " << metrics.bytes_sent << ",\n"
+	   << indent << "\"bytes_received\": " << metrics.bytes_received << ",\n"
+	   << indent << "\"round_trips\": " << metrics.round_trips << ",\n"
+	   << indent << "\"hash_commands\": " << metrics.hash_commands << ",\n"
+	   << indent << "\"rows_commands\": " << metrics.rows_commands << ",\n"
+	   << indent << "\"read_seconds\": " << metrics.read_seconds << ",\n"
+	   << indent << "\"hash_seconds\": " << metrics.hash_seconds << ",\n"
+	   << indent << "\"network_wait_seconds\": " << metrics.network_wait_seconds << ",\n"
+	   << indent << "\"apply_seconds\": " << metrics.apply_seconds << ",\n"
+	   << indent << "\"commit_seconds\": " << metrics.commit_seconds << ",\n"
+	   << indent << "\"rows_inserted\": " << metrics.rows_inserted << ",\n"
+	   << indent << "\"rows_updated\": " << metrics.rows_updated << ",\n"
+	   << indent << "\"rows_deleted\": " << metrics.rows_deleted << ",\n"
+	   << indent << "\"range_deletes\": " << metrics.range_deletes << ",\n"
+	   << indent << "\"tables_analyzed\": " << metrics.tables_analyzed << ",\n"
+	   << indent << "\"analyze_seconds\": " << metrics.analyze_seconds << ",\n"
+	   << indent << "\"hashed_range_rows_histogram\": ";
+	write_histogram(os, metrics.hashed_ranges);
+	os << ",\n" << indent << "\"rows_range_rows_histogram\": ";
+	write_histogram(os, metrics.rows_ranges);
+}
+
+void write_metrics_json(ostream &os, const vector<WorkerMetrics> &workers) {
+	os << fixed << setprecision(6);
+	os << "{\n  \"workers\": [";
+	for (size_t worker = 0; worker < workers.size(); worker++) {
+		os << (worker ? ",\n" : "\n") << "    {\n      \"worker\": " << worker << ",\n";
+		write_metrics(os, workers[worker].totals, "      ");
+		os << ",\n      \"tables\": [";
+		for (size_t table = 0; table < workers[worker].tables.size(); table++) {
+			os << (table ? ",\n" : "\n") << "        {\n          \"table\": ";
+			write_json_string(os, workers[worker].tables[table].name);
+			os << ",\n";
+			write_metrics(os, workers[worker].tables[table], "          ");
+			os << "\n        }";
+		}
+		os << "\n      ]\n    }";
+	}
+	os << "\n  ]\n}\n";
+}
@@ -0,0 +1,88 @@
+#ifndef SYNC_METRICS_H
+#define SYNC_METRICS_H
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <stdint.h>
+
+using namespace std;
+
+inline double seconds_since(chrono::steady_clock::time_point started) {
+	return chrono::duration<double>(chrono::steady_clock::now() - started).count();
+}
+
+// counts ranges by number of rows, in powers of two: bucket 0 is the empty ranges, bucket 1 the ranges with 1 row,
+// bucket 2 those with 2-3 rows, bucket 3 those with 4-7 rows, and so on
+struct RangeSizeHistogram {
+	void add(size_t rows) {
+		size_t bucket = 0;
+		while (rows) {
+			bucket++;
+			rows >>= 1;
+		}
+		if (counts.size() <= bucket) counts.resize(bucket + 1);
+		counts[bucket]++;
+	}
+
+	RangeSizeHistogram &operator +=(const RangeSizeHistogram &other);
+
+	vector<size_t> counts;
+};
+
+// what a worker spent its time on while synchronizing a table, or over the whole run.  used to tell whether a sync
+// is held up by the network, the 'from' end, or the database at our end.
+struct SyncMetrics {
+	SyncMetrics(const string &name = string()): name(name), elapsed_seconds(0), bytes_sent(0), bytes_received(0), round_trips(0), hash_commands(0), rows_commands(0),
+		read_seconds(0), hash_seconds(0), network_wait_seconds(0), apply_seconds(0), commit_seconds(0), rows_inserted(0), rows_updated(0), rows_deleted(0), range_deletes(0),
+		tables_analyzed(0), analyze_seconds(0) {}
+
+	SyncMetrics &operator +=(const SyncMetrics &other);
+
+	string name;
+	double elapsed_seconds;
+	uint64_t bytes_sent;
+	uint64_t bytes_received;
+	size_t round_trips;
+	size_t hash_commands;
+	size_t rows_commands;
+	double read_seconds;         // waiting for the database to return rows or counts
+	double hash_seconds;         // hashing or otherwise processing the rows it returned
+	double network_wait_seconds; // waiting for the other end to send the next command
+	double apply_seconds;        // running the statements that apply the changes
+	double commit_seconds;
+	size_t rows_inserted;
+	size_t rows_updated;
+	size_t rows_deleted;         // not including rows removed by range deletes, which aren't counted
+	size_t range_deletes;
+	size_t tables_analyzed;      // whose statistics we refreshed because so many of their rows had changed
+	double analyze_seconds;
+	RangeSizeHistogram hashed_ranges;
+	RangeSizeHistogram rows_ranges;
+};
+
+// passes rows on to another row receiver, adding up the time it takes to process them
+template <typename RowReceiver>
+struct TimedRowReceiver {
+	TimedRowReceiver(RowReceiver &row_receiver, double &seconds): row_receiver(row_receiver), seconds(seconds) {}
+
+	template <typename DatabaseRow>
+	inline void operator()(const DatabaseRow &row) {
+		chrono::steady_clock::time_point started(chrono::steady_clock::now());
+		row_receiver(row);
+		seconds += seconds_since(started);
+	}
+
+	RowReceiver &row_receiver;
+	double &seconds;
+};
+
+struct WorkerMetrics {
+	SyncMetrics totals;
+	vector<SyncMetrics> tables;
+};
+
+void write_metrics_json(ostream &os, const vector<WorkerMetrics> &workers);
+
+#endif
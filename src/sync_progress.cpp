@@ -0,0 +1,113 @@
+#include "sync_progress.h"
+
+#include <sstream>
+
+string format_duration(uint64_t seconds) {
+	char buffer[32];
+	if (seconds >= 3600) {
+		snprintf(buffer, sizeof(buffer), "%luh%02lum", (unsigned long)(seconds/3600), (unsigned long)(seconds/60 % 60));
+	} else if (seconds >= 60) {
+		snprintf(buffer, sizeof(buffer), "%lum%02lus", (unsigned long)(seconds/60), (unsigned long)(seconds % 60));
+	} else {
+		snprintf(buffer, sizeof(buffer), "%lus", (unsigned long)seconds);
+	}
+	return buffer;
+}
+
+void SyncProgress::enqueue(const Tables &tables) {
+	unique_lock<std::mutex> lock(mutex);
+	for (const Table &table : tables) {
+		table_progress[&table];
+	}
+}
+
+void SyncProgress::start_range(size_t worker, const Table &table) {
+	unique_lock<std::mutex> lock(mutex);
+	worker_progress[worker].table = &table;
+	worker_progress[worker].position.clear();
+	worker_progress[worker].table_rows = 0;
+	table_progress[&table].ranges_in_progress++;
+	table_progress[&table].started = true;
+}
+
+void SyncProgress::update(size_t worker, const string &position, uint64_t rows, uint64_t bytes) {
+	// rows is the number processed since the last update
+	unique_lock<std::mutex> lock(mutex);
+	WorkerProgress &progress(worker_progress[worker]);
+	if (!position.empty()) progress.position = position;
+	progress.rows += rows;
+	progress.table_rows += rows;
+	progress.bytes = bytes;
+	if (progress.table) table_progress[progress.table].rows += rows;
+}
+
+void SyncProgress::finish_range(size_t worker) {
+	unique_lock<std::mutex> lock(mutex);
+	WorkerProgress &progress(worker_progress[worker]);
+	if (progress.table) table_progress[progress.table].ranges_in_progress--;
+	progress.table = nullptr;
+}
+
+void SyncProgress::worker_finished() {
+	unique_lock<std::mutex> lock(mutex);
+	workers_running--;
+	cond.notify_all();
+}
+
+bool SyncProgress::wait(chrono::seconds interval) {
+	// returns false once all the workers have finished, or true if the interval passed first
+	unique_lock<std::mutex> lock(mutex);
+	chrono::steady_clock::time_point until(chrono::steady_clock::now() + interval);
+	while (workers_running) {
+		if (cond.wait_until(lock, until) == cv_status::timeout) return (workers_running > 0);
+	}
+	return false;
+}
+
+string SyncProgress::report() {
+	unique_lock<std::mutex> lock(mutex);
+	double elapsed = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+
+	// tables that we've finished count as done regardless of how good the estimate was; for the others, we assume
+	// the rows we haven't reached yet are still to do
+	uint64_t rows_done = 0, rows_to_do = 0;
+	size_t tables_done = 0, tables_unknown = 0;
+	for (const auto &entry : table_progress) {
+		const Table &table(*entry.first);
+		const TableProgress &progress(entry.second);
+		rows_done += progress.rows;
+		if (progress.started && !progress.ranges_in_progress) {
+			tables_done++;
+		} else if (!table.estimated_rows) {
+			tables_unknown++;
+		} else if (table.estimated_rows > progress.rows) {
+			rows_to_do += table.estimated_rows - progress.rows;
+		}
+	}
+
+	ostringstream os;
+	os << "progress: " << tables_done << " of " << table_progress.size() << " tables done, " << rows_done << " rows processed";
+	if (rows_to_do) os << ", ~" << rows_to_do << " to go";
+	if (tables_unknown) os << " plus " << tables_unknown << " tables of unknown size";
+	if (elapsed > 0 && rows_done) {
+		double rate = rows_done/elapsed;
+		os << ", " << (uint64_t)rate << " rows/s";
+		if (rows_to_do) os << ", ETA " << format_duration(rows_to_do/rate) << (tables_unknown ? "+" : "");
+	}
+
+	for (size_t worker = 0; worker < worker_progress.size(); worker++) {
+		const WorkerProgress &progress(worker_progress[worker]);
+		os << "\n  worker " << worker << ": ";
+		if (progress.table) {
+			os << progress.table->name;
+			if (!progress.position.empty()) os << " at " << progress.position;
+			os << ", " << progress.table_rows;
+			if (progress.table->estimated_rows) os << " of ~" << progress.table->estimated_rows;
+			os << " rows";
+		} else {
+			os << "idle";
+		}
+		if (elapsed > 0) os << "; " << (uint64_t)(progress.rows/elapsed) << " rows/s, " << progress.bytes/1048576 << " MB transferred";
+	}
+	return os.str();
+}
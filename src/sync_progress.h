@@ -0,0 +1,59 @@
+#ifndef SYNC_PROGRESS_H
+#define SYNC_PROGRESS_H
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "schema.h"
+
+using namespace std;
+
+string format_duration(uint64_t seconds);
+
+// keeps track of how far each worker has got, so that we can periodically tell the user how far through we are and
+// estimate how long there is to go.  progress is measured in rows, against the row counts in the database's
+// statistics for our copy of each table; tables we don't have any rows for can't be estimated.
+struct SyncProgress {
+	SyncProgress(size_t workers): workers_running(workers), worker_progress(workers), started(chrono::steady_clock::now()) {}
+
+	void enqueue(const Tables &tables);
+	void start_range(size_t worker, const Table &table);
+	void update(size_t worker, const string &position, uint64_t rows, uint64_t bytes);
+	void finish_range(size_t worker);
+	void worker_finished();
+	bool wait(chrono::seconds interval);
+	string report();
+
+protected:
+	struct WorkerProgress {
+		WorkerProgress(): table(nullptr), rows(0), table_rows(0), bytes(0) {}
+
+		const Table *table;
+		string position;
+		uint64_t rows;       // processed by this worker so far, in all tables
+		uint64_t table_rows; // processed by this worker so far, in its current range
+		uint64_t bytes;      // sent and received by this worker so far
+	};
+
+	struct TableProgress {
+		TableProgress(): rows(0), ranges_in_progress(0), started(false) {}
+
+		uint64_t rows;
+		size_t ranges_in_progress;
+		bool started;
+	};
+
+	std::mutex mutex;
+	std::condition_variable cond;
+	size_t workers_running;
+	vector<WorkerProgress> worker_progress;
+	map<const Table*, TableProgress> table_progress;
+	chrono::steady_clock::time_point started;
+};
+
+#endif
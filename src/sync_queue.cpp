@@ -1,10 +1,27 @@
 #include "sync_queue.h"
 
+#include <algorithm>
+
+bool larger_table_first(const Table *a, const Table *b) {
+	// we don't have an estimate for tables that are empty at our end, and since they need to be copied in full, they
+	// could be the biggest job of all, so we start them first.  we tell these by their row count rather than their
+	// size, since even an empty table takes up a page or two for its data and keys.
+	if (!a->estimated_rows || !b->estimated_rows) return (!a->estimated_rows && b->estimated_rows);
+	return (a->estimated_size > b->estimated_size);
+}
+
 void SyncQueue::enqueue(const Tables &tables) {
 	unique_lock<std::mutex> lock(mutex);
+	vector<const Table*> tables_to_queue;
 	for (const Table &from_table : tables) {
-		queue.push_back(&from_table);
+		tables_to_queue.push_back(&from_table);
 	}
+
+	// workers take tables from the front of the queue as they become free, so starting the largest tables first gives
+	// a longest-processing-time-first schedule, which stops one huge table starting last and holding up the end of the
+	// run.  the sort is stable so that ties keep the order the other end listed the tables in, which is also by size.
+	stable_sort(tables_to_queue.begin(), tables_to_queue.end(), larger_table_first);
+	queue.insert(queue.end(), tables_to_queue.begin(), tables_to_queue.end());
 }
 
 const Table* SyncQueue::pop() {
@@ -15,3 +32,130 @@ const Table* SyncQueue::pop() {
 	queue.pop_front();
 	return table;
 }
+
+void SyncQueue::enqueue_statements(const vector< list<string> > &statement_groups) {
+	unique_lock<std::mutex> lock(mutex);
+	for (const list<string> &statements : statement_groups) {
+		if (!statements.empty()) statements_queue.push_back(statements);
+	}
+}
+
+bool SyncQueue::pop_statements(list<string> &statements) {
+	unique_lock<std::mutex> lock(mutex);
+	if (aborted) throw aborted_error();
+	if (statements_queue.empty()) return false;
+	statements.swap(statements_queue.front());
+	statements_queue.pop_front();
+	return true;
+}
+
+vector<const Table*> SyncQueue::predicted_critical_path() {
+	// simulate the workers taking the queued tables in order, assuming the time taken is proportional to the size
+	unique_lock<std::mutex> lock(mutex);
+	vector<uint64_t> worker_sizes(workers);
+	vector< vector<const Table*> > worker_tables(workers);
+
+	for (const Table *table : queue) {
+		size_t worker = min_element(worker_sizes.begin(), worker_sizes.end()) - worker_sizes.begin();
+		worker_sizes[worker] += table->estimated_size;
+		worker_tables[worker].push_back(table);
+	}
+
+	size_t busiest_worker = max_element(worker_sizes.begin(), worker_sizes.end()) - worker_sizes.begin();
+	return worker_tables[busiest_worker];
+}
+
+void SyncQueue::start_range(TableRange &range, bool new_table) {
+	// ranges taken over from another worker were already counted when the split was accepted
+	unique_lock<std::mutex> lock(mutex);
+	range.id = next_range_id++;
+	ranges.push_back(&range);
+	if (new_table) ranges_in_progress[&range.table]++;
+}
+
+bool SyncQueue::split_requested(TableRange &range) {
+	// called by the worker synchronizing the range at each turn; if this returns true, it must answer the request
+	unique_lock<std::mutex> lock(mutex);
+	return (range.split_request != nullptr);
+}
+
+void SyncQueue::accept_split(TableRange &range, const ColumnValues &split_key) {
+	unique_lock<std::mutex> lock(mutex);
+	SplitRequest *request = range.split_request;
+	request->split_key = split_key;
+	request->end_key = range.end_key;
+	request->accepted = true;
+	request->answered = true;
+	range.split_request = nullptr;
+	range.end_key = split_key;
+	ranges_in_progress[&range.table]++;
+	cond.notify_all();
+}
+
+void SyncQueue::reject_split(TableRange &range) {
+	unique_lock<std::mutex> lock(mutex);
+	if (!range.split_request) return;
+	range.split_request->accepted = false;
+	range.split_request->answered = true;
+	range.split_request = nullptr;
+	cond.notify_all();
+}
+
+void SyncQueue::remove_range(TableRange &range) {
+	// called when the worker has no more turns in which it could answer a request, including when aborting
+	unique_lock<std::mutex> lock(mutex);
+	if (range.split_request) {
+		range.split_request->accepted = false;
+		range.split_request->answered = true;
+		range.split_request = nullptr;
+		cond.notify_all();
+	}
+	ranges.remove(&range);
+}
+
+bool SyncQueue::finish_range(TableRange &range, size_t rows_affected, size_t &table_rows_affected) {
+	// called once the range's changes have been committed, or would have been if we don't commit after each table;
+	// returns true if this was the last of the table's ranges to finish, and gives the rows changed in all of them
+	unique_lock<std::mutex> lock(mutex);
+	table_rows_affected = (rows_affected_in_table[&range.table] += rows_affected);
+	return (--ranges_in_progress[&range.table] == 0);
+}
+
+bool SyncQueue::range_to_split(const set<size_t> &ranges_to_skip, size_t &range_id, const Table *&table) {
+	unique_lock<std::mutex> lock(mutex);
+	if (aborted) throw aborted_error();
+	for (TableRange *range : ranges) {
+		if (range->splittable && !range->split_request && !ranges_to_skip.count(range->id)) {
+			range_id = range->id;
+			table = &range->table;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool SyncQueue::request_split(size_t range_id, SplitRequest &request) {
+	// asks the worker synchronizing the range to hand over part of it, and waits for it to answer at its next turn
+	unique_lock<std::mutex> lock(mutex);
+	if (aborted) throw aborted_error();
+
+	list<TableRange*>::iterator range = ranges.begin();
+	while (range != ranges.end() && (*range)->id != range_id) ++range;
+	if (range == ranges.end() || (*range)->split_request) return false;
+
+	request.answered = false;
+	request.accepted = false;
+	(*range)->split_request = &request;
+
+	while (!request.answered) {
+		cond.wait(lock);
+		if (aborted) {
+			// the range may have been removed since we started waiting, so look it up again
+			for (TableRange *candidate : ranges) {
+				if (candidate->split_request == &request) candidate->split_request = nullptr;
+			}
+			throw aborted_error();
+		}
+	}
+	return request.accepted;
+}
@@ -3,21 +3,62 @@
 
 #include <queue>
 #include <list>
+#include <map>
 #include <set>
+#include <vector>
 
 #include "abortable_barrier.h"
 #include "schema.h"
 
 using namespace std;
 
+// asks the worker synchronizing a range to hand over the rest of the range after a key it hasn't reached yet;
+// owned by the requesting worker, and filled in by the range's worker when it answers.
+struct SplitRequest {
+	bool answered;
+	bool accepted;
+	ColumnValues split_key; // the requester takes over the rows > this key
+	ColumnValues end_key;   // and <= this key; [] for the end of the table
+};
+
+// the part of a table that a worker is currently synchronizing.
+struct TableRange {
+	TableRange(const Table &table): table(table), id(0), splittable(false), split_request(nullptr) {}
+
+	const Table &table;
+	size_t id;
+	ColumnValues end_key; // [] for the end of the table
+	bool splittable;
+	SplitRequest *split_request;
+};
+
 struct SyncQueue: public AbortableBarrier {
-	SyncQueue(size_t workers): AbortableBarrier(workers) {}
+	SyncQueue(size_t workers): AbortableBarrier(workers), next_range_id(1) {}
 
 	void enqueue(const Tables &tables);
 	const Table* pop();
+	void enqueue_statements(const vector< list<string> > &statement_groups);
+	bool pop_statements(list<string> &statements);
+	vector<const Table*> predicted_critical_path();
+
+	void start_range(TableRange &range, bool new_table);
+	bool split_requested(TableRange &range);
+	void accept_split(TableRange &range, const ColumnValues &split_key);
+	void reject_split(TableRange &range);
+	void remove_range(TableRange &range);
+	bool finish_range(TableRange &range, size_t rows_affected, size_t &table_rows_affected);
+	bool range_to_split(const set<size_t> &ranges_to_skip, size_t &range_id, const Table *&table);
+	bool request_split(size_t range_id, SplitRequest &request);
 	
 	list<const Table*> queue;
+	list< list<string> > statements_queue;
 	string snapshot;
+
+protected:
+	list<TableRange*> ranges;
+	map<const Table*, size_t> ranges_in_progress;
+	map<const Table*, size_t> rows_affected_in_table;
+	size_t next_range_id;
 };
 
 #endif
@@ -0,0 +1,34 @@
+#ifndef SYNC_THRESHOLDS_H
+#define SYNC_THRESHOLDS_H
+
+#include <cstddef>
+
+// the number of rows changed in a table after which we expect rebuilding its keys at the end to be
+// cheaper than maintaining them for each of the remaining changes
+const size_t DEFER_KEYS_AFTER_ROWS_CHANGED = 100000;
+
+// ranges of rows to delete are deleted in chunks of at most this many rows, so that clearing the tail of a table
+// doesn't hold locks or build up undo/WAL for the whole range in one statement
+const size_t DELETE_RANGE_CHUNK_ROWS = 10000;
+
+// we only hand over part of a table to another worker if we'd both have at least this many rows left to synchronize
+const size_t MINIMUM_ROWS_TO_SHARE = 10000;
+
+// once this many rows and this percentage of the table's estimated rows have changed, we ask the database to
+// refresh the table's statistics after committing, rather than leave queries planned using the old ones until its
+// own automatic statistics collection gets around to the table
+const size_t ANALYZE_AFTER_ROWS_CHANGED = 1000;
+const size_t ANALYZE_AFTER_PERCENT_CHANGED = 10;
+
+// the sizes at which the 'to' end switches to a different way of doing its work.  the defaults suit real tables;
+// the tests give much smaller values so that they can exercise each way with a handful of rows.
+struct SyncThresholds {
+	SyncThresholds(): defer_keys_after_rows_changed(DEFER_KEYS_AFTER_ROWS_CHANGED), delete_range_chunk_rows(DELETE_RANGE_CHUNK_ROWS), minimum_rows_to_share(MINIMUM_ROWS_TO_SHARE), analyze_after_rows_changed(ANALYZE_AFTER_ROWS_CHANGED) {}
+
+	size_t defer_keys_after_rows_changed;
+	size_t delete_range_chunk_rows;
+	size_t minimum_rows_to_share;
+	size_t analyze_after_rows_changed;
+};
+
+#endif
@@ -4,25 +4,34 @@
 #include "schema_functions.h"
 #include "schema_matcher.h"
 #include "sync_queue.h"
+#include "sync_progress.h"
 #include "table_row_applier.h"
 #include "fdstream.h"
 #include <boost/algorithm/string.hpp>
 #include <thread>
+#include <chrono>
+#include <fstream>
 
 using namespace std;
 
 #define VERY_VERBOSE 2
 
+// to find the middle of the rest of our range we count its rows, but only if there are less than twice this many; if
+// there are more, we keep this many and hand over the rest, which can be shared again in turn
+const size_t MAXIMUM_ROWS_TO_KEEP_WHEN_SHARING = 1000000;
+
 template <typename DatabaseClient>
 struct SyncToWorker {
 	SyncToWorker(
-		Database &database, SyncQueue &sync_queue, bool leader, int read_from_descriptor, int write_to_descriptor,
+		Database &database, SyncQueue &sync_queue, SyncProgress &progress, size_t worker_number, int read_from_descriptor, int write_to_descriptor,
 		const string &database_host, const string &database_port, const string &database_name, const string &database_username, const string &database_password,
 		const string &set_variables, const set<string> &ignore_tables, const set<string> &only_tables,
-		int verbose, bool snapshot, bool alter, CommitLevel commit_level):
+		int verbose, bool snapshot, bool alter, CommitLevel commit_level, bool apply_in_background, bool binary_key_order, const SyncThresholds &thresholds, bool collect_metrics):
 			database(database),
 			sync_queue(sync_queue),
-			leader(leader),
+			progress(progress),
+			worker_number(worker_number),
+			leader(worker_number == 0),
 			input_stream(read_from_descriptor),
 			output_stream(write_to_descriptor),
 			input(input_stream),
@@ -34,21 +43,36 @@ struct SyncToWorker {
 			snapshot(snapshot),
 			alter(alter),
 			commit_level(commit_level),
+			binary_key_order(binary_key_order),
+			thresholds(thresholds),
 			protocol_version(0),
+			apply_queue(apply_in_background ? new ApplyQueue(BACKGROUND_APPLY_QUEUE_SIZE) : nullptr),
+			read_connection(apply_in_background ? new DatabaseClient(database_host, database_port, database_name, database_username, database_password) : nullptr),
+			current_row_applier(nullptr),
+			current_range(nullptr),
+			collect_metrics(collect_metrics),
+			range_metrics(nullptr),
+			rows_since_progress_update(0),
+			progress_updated(0),
 			worker_thread(std::ref(*this)) {
 		if (!set_variables.empty()) {
 			client.execute("SET " + set_variables);
+			if (read_connection) read_connection->execute("SET " + set_variables);
 		}
 	}
 
 	~SyncToWorker() {
-		worker_thread.join();
+		if (worker_thread.joinable()) worker_thread.join();
 	}
 
 	void operator()() {
+		chrono::steady_clock::time_point started(chrono::steady_clock::now());
+		Trace::name_thread("worker " + to_string(worker_number));
+
 		try {
 			negotiate_protocol();
 			negotiate_target_block_size();
+			negotiate_key_order();
 
 			share_snapshot();
 			retrieve_database_schema();
@@ -61,6 +85,11 @@ struct SyncToWorker {
 
 			if (commit_level >= CommitLevel::success) {
 				commit();
+
+				// a table split between workers is analyzed by the last to finish it, so wait for the others to commit
+				// their rows before any are analyzed
+				sync_queue.wait_at_barrier();
+				analyze_tables();
 			} else {
 				rollback();
 			}
@@ -76,19 +105,25 @@ struct SyncToWorker {
 			}
 		}
 
+		// the totals for the whole run include the traffic and waits outside the tables, such as the schema exchange
+		metrics.totals.elapsed_seconds = seconds_since(started);
+		metrics.totals.bytes_sent = output_stream.bytes_written;
+		metrics.totals.bytes_received = input_stream.bytes_read;
+		metrics.totals.network_wait_seconds = chrono::duration<double>(input_stream.read_wait).count();
+		progress.worker_finished();
+
 		// eagerly close the streams so that the SSH session terminates promptly on aborts
 		output_stream.close();
 	}
 
 	void negotiate_protocol() {
 		const int EARLIEST_PROTOCOL_VERSION_SUPPORTED = 5;
-		const int LATEST_PROTOCOL_VERSION_SUPPORTED = 5;
+		const int LATEST_PROTOCOL_VERSION_SUPPORTED = 9;
 
 		// tell the other end what version of the protocol we can speak, and have them tell us which version we're able to converse in
 		send_command(output, Commands::PROTOCOL, LATEST_PROTOCOL_VERSION_SUPPORTED);
 
 		// read the response to the protocol_version command that the output thread sends when it starts
-		// this is currently unused, but the command's semantics need to be in place for it to be useful in the future...
 		read_expected_command(input, Commands::PROTOCOL, protocol_version);
 
 		if (protocol_version < EARLIEST_PROTOCOL_VERSION_SUPPORTED || protocol_version > LATEST_PROTOCOL_VERSION_SUPPORTED) {
@@ -105,6 +140,19 @@ struct SyncToWorker {
 		read_expected_command(input, Commands::TARGET_BLOCK_SIZE, target_block_size);
 	}
 
+	void negotiate_key_order() {
+		// if the two ends are different types of database, their collations may order string keys differently, so we
+		// ask the other end to order them by their bytes, as we will.  older versions can't, so ranges with string keys
+		// may not match up; that still gives the right result, it just means sending more rows.
+		if (!binary_key_order) return;
+		if (protocol_version < 9) {
+			binary_key_order = false;
+			return;
+		}
+		send_command(output, Commands::BINARY_KEY_ORDER);
+		read_expected_command(input, Commands::BINARY_KEY_ORDER);
+	}
+
 	void share_snapshot() {
 		if (sync_queue.workers > 1 && snapshot) {
 			// although some databases (such as postgresql) can share & adopt snapshots with no penalty
@@ -117,9 +165,12 @@ struct SyncToWorker {
 			sync_queue.wait_at_barrier();
 
 			// now, request the lock or snapshot from the leader's peer.
+			chrono::steady_clock::time_point requested, acquired;
 			if (leader) {
+				requested = chrono::steady_clock::now();
 				send_command(output, Commands::EXPORT_SNAPSHOT);
 				read_expected_command(input, Commands::EXPORT_SNAPSHOT, sync_queue.snapshot);
+				acquired = chrono::steady_clock::now();
 			}
 			sync_queue.wait_at_barrier();
 
@@ -135,6 +186,14 @@ struct SyncToWorker {
 			if (leader) {
 				send_command(output, Commands::UNHOLD_SNAPSHOT);
 				read_expected_command(input, Commands::UNHOLD_SNAPSHOT);
+
+				// the lock is what other transactions at the 'from' end have to wait for, so report how long it took
+				// to get and how long we held it (as seen from here, so including the network round trips)
+				if (verbose) {
+					chrono::steady_clock::time_point released = chrono::steady_clock::now();
+					unique_lock<mutex> lock(sync_queue.mutex);
+					cout << "acquired snapshot in " << chrono::duration_cast<chrono::milliseconds>(acquired - requested).count() << "ms and released it after " << chrono::duration_cast<chrono::milliseconds>(released - acquired).count() << "ms" << endl << flush;
+				}
 			}
 		} else {
 			send_command(output, Commands::WITHOUT_SNAPSHOT);
@@ -149,6 +208,9 @@ struct SyncToWorker {
 			read_expected_command(input, Commands::SCHEMA, database);
 			client.convert_unsupported_database_schema(database);
 			filter_tables(database.tables);
+			for (Table &table : database.tables) {
+				table.binary_key_order = binary_key_order;
+			}
 		}
 	}
 
@@ -158,22 +220,17 @@ struct SyncToWorker {
 			Database to_database;
 			client.populate_database_schema(to_database);
 			filter_tables(to_database.tables);
+			estimate_table_sizes(to_database);
+			use_column_collations(to_database);
 
 			// check they match, and if not, figure out what DDL we would need to run to fix the 'to' end's schema
 			SchemaMatcher<DatabaseClient> matcher(client);
 
 			matcher.match_schemas(database, to_database);
 
-			if (matcher.statements.empty()) return;
-
-			if (alter) {
-				for (const string &statement : matcher.statements) {
-					if (verbose) cout << statement << endl;
-					if (statement.substr(0, 2) != "--") { // stop postgresql printing the comments to stderr
-						client.execute(statement);
-					}
-				}
-			} else {
+			if (!matcher.statements.empty() && alter) {
+				sync_queue.enqueue_statements(matcher.statement_groups);
+			} else if (!matcher.statements.empty()) {
 				cerr << "The database schema doesn't match.  Use the --alter option if you would like to automatically apply the following schema changes:" << endl << endl;
 				for (const string &statement : matcher.statements) {
 					cerr << statement << endl;
@@ -182,6 +239,60 @@ struct SyncToWorker {
 				throw runtime_error("Database schema needs migration");
 			}
 		}
+
+		// wait for the leader to queue up any statements needed, then run them in all the workers at once.  rebuilding
+		// tables and keys can take a long time, so we don't want the other workers idle while the leader does it all.
+		sync_queue.wait_at_barrier();
+		alter_schema();
+		sync_queue.wait_at_barrier();
+	}
+
+	void alter_schema() {
+		// the statements are grouped by table, and each group must be run in order on one connection, but the groups
+		// are independent of each other
+		Statements statements;
+		while (sync_queue.pop_statements(statements)) {
+			for (const string &statement : statements) {
+				if (verbose) {
+					unique_lock<mutex> lock(sync_queue.mutex);
+					cout << statement << endl;
+				}
+				if (statement.substr(0, 2) != "--") { // stop postgresql printing the comments to stderr
+					client.execute(statement);
+				}
+			}
+		}
+	}
+
+	void estimate_table_sizes(const Database &to_database) {
+		// the schema the other end sends us doesn't include their table statistics, so we schedule using the size of
+		// our copy of each table, which is what we need to hash; if we have no copy, the estimates are left at zero.
+		map<string, const Table*> to_tables;
+		for (const Table &table : to_database.tables) {
+			to_tables[table.name] = &table;
+		}
+		for (Table &table : database.tables) {
+			if (to_tables.count(table.name)) {
+				table.estimated_size = to_tables[table.name]->estimated_size;
+				table.estimated_rows = to_tables[table.name]->estimated_rows;
+			}
+		}
+	}
+
+	void use_column_collations(const Database &to_database) {
+		// likewise, we need to know which of our string columns already sort by their bytes, so their keys don't need
+		// a different collation.  if we're going to alter the table, we don't know what they'll be, so assume not.
+		map<string, const Table*> to_tables;
+		for (const Table &table : to_database.tables) {
+			to_tables[table.name] = &table;
+		}
+		for (Table &table : database.tables) {
+			if (to_tables.count(table.name) && *to_tables[table.name] == table) {
+				for (size_t column_index = 0; column_index < table.columns.size(); column_index++) {
+					table.columns[column_index].binary_collation = to_tables[table.name]->columns[column_index].binary_collation;
+				}
+			}
+		}
 	}
 
 	void filter_tables(Tables &tables) {
@@ -200,6 +311,8 @@ struct SyncToWorker {
 		// queue up all the tables
 		if (leader) {
 			sync_queue.enqueue(database.tables);
+			progress.enqueue(database.tables);
+			if (verbose) show_predicted_critical_path();
 		}
 
 		// wait for the leader to do that (a barrier here is slightly excessive as we don't care if the other
@@ -207,6 +320,18 @@ struct SyncToWorker {
 		sync_queue.wait_at_barrier();
 	}
 
+	void show_predicted_critical_path() {
+		uint64_t total_size = 0;
+		string table_names;
+		for (const Table *table : sync_queue.predicted_critical_path()) {
+			total_size += table->estimated_size;
+			if (!table_names.empty()) table_names += ", ";
+			table_names += table->name;
+			if (!table->estimated_rows) table_names += " (size unknown)";
+		}
+		cout << "predicted critical path is " << total_size/1048576 << " MB: " << table_names << endl << flush;
+	}
+
 	void sync_tables() {
 		client.disable_referential_integrity();
 
@@ -214,14 +339,15 @@ struct SyncToWorker {
 			// grab the next table to work on from the queue (blocking if it's empty)
 			const Table *table = sync_queue.pop();
 
-			// quit if there's no more tables to process
-			if (!table) break;
+			if (table) {
+				// synchronize that table, offering the part we haven't reached yet to any workers that run out of tables
+				TableRange range(*table);
+				sync_range(range, nullptr);
 
-			// synchronize that table (unfortunately we can't share this job with other workers because next-key
-			// locking is used for unique key indexes to enforce the uniqueness constraint, so we can't share
-			// write traffic to the database across connections, which makes it somewhat futile to try and farm the
-			// read work out since that needs to see changes made to satisfy unique indexes earlier in the table)
-			sync_table(*table);
+			} else if (!take_over_range()) {
+				// quit if there's no more tables to process, and no other worker has enough left to share
+				break;
+			}
 		}
 
 		// send a quit so the other end closes its output and terminates gracefully
@@ -232,69 +358,307 @@ struct SyncToWorker {
 		client.enable_referential_integrity();
 	}
 
-	void sync_table(const Table &table) {
-		TableRowApplier<DatabaseClient> row_applier(client, table, commit_level >= CommitLevel::often);
-		size_t hash_commands = 0;
-		size_t rows_commands = 0;
+	bool take_over_range() {
+		// we've run out of tables, so ask the workers that are still busy to hand over the end of their current range.
+		// we can't share one worker's write traffic across connections, but we can give each connection its own key
+		// range, as long as the changes in one range can't conflict with the rows in another.
+		if (protocol_version < 7) return false;
+
+		set<size_t> ranges_to_skip;
+		size_t range_id;
+		const Table *table;
+		SplitRequest request;
+
+		while (sync_queue.range_to_split(ranges_to_skip, range_id, table)) {
+			if (sync_queue.request_split(range_id, request)) {
+				TableRange range(*table);
+				range.end_key = request.end_key;
+				sync_range(range, &request.split_key);
+				return true;
+			}
+
+			// don't ask the same worker about the same range again, as it will only have less left to share
+			ranges_to_skip.insert(range_id);
+		}
+
+		return false;
+	}
+
+	bool range_can_be_split(const Table &table) {
+		// another worker can take over part of the table only if the changes it makes can't conflict with ours, which
+		// means the primary key must be the only unique key; and on databases that need their sequences reset after
+		// loading, the last worker to finish has to see the other workers' changes, so they must commit as they go
+		if (protocol_version < 7) return false;
+		for (const Key &key : table.keys) {
+			if (key.unique && key.columns != table.primary_key_columns) return false;
+		}
+		return (commit_level >= CommitLevel::tables || !ResetTableSequences<DatabaseClient>::required(table));
+	}
+
+	void sync_range(TableRange &range, const ColumnValues *start_after_key) {
+		const Table &table(range.table);
+		size_t rows_changed = 0, rows_affected = 0;
 		time_t started = time(nullptr);
 		bool finished = false;
+		bool range_shared = false;
+
+		SyncMetrics table_metrics(table.name);
+		chrono::steady_clock::time_point started_at(chrono::steady_clock::now());
+		uint64_t bytes_sent_before = output_stream.bytes_written;
+		uint64_t bytes_received_before = input_stream.bytes_read;
+		chrono::steady_clock::duration read_wait_before = input_stream.read_wait;
+		range_metrics = &table_metrics;
 
 		if (verbose) {
 			unique_lock<mutex> lock(sync_queue.mutex);
-			cout << "starting " << table.name << endl << flush;
+			if (start_after_key) {
+				cout << "taking over " << table.name << " after " << values_list(client, table, *start_after_key) << endl << flush;
+			} else {
+				cout << "starting " << table.name << endl << flush;
+			}
 		}
 
-		send_command(output, Commands::OPEN, table.name);
+		try {
+			TableRowApplier<DatabaseClient> row_applier(client, table, commit_level >= CommitLevel::often, thresholds, apply_queue.get(), read_connection.get());
+			row_applier.end_key = range.end_key;
+			row_applier.range_shared = (start_after_key != nullptr);
+			row_applier.metrics = &table_metrics;
+			current_row_applier = &row_applier;
+			current_range = &range;
+
+			if (start_after_key) {
+				// carry on from where the other worker will stop; we send the first command in this case, since our
+				// peer doesn't know where to start
+				range.splittable = range_can_be_split(table);
+				send_command(output, Commands::SELECT_TABLE, table.name);
+				if (!range.end_key.empty()) send_command(output, Commands::END_KEY, range.end_key);
+				hash_next_range(*this, table, *start_after_key, 1, target_block_size);
+			} else if (protocol_version >= 6 && table_empty(table)) {
+				// there's nothing at our end to compare, so skip trading hashes and ask for the whole table straight away
+				row_applier.defer_keys();
+				send_command(output, Commands::SELECT_TABLE, table.name);
+				send_rows_command(table, ColumnValues(), ColumnValues());
+			} else {
+				range.splittable = range_can_be_split(table);
+				send_command(output, Commands::OPEN, table.name);
+			}
+			sync_queue.start_range(range, start_after_key == nullptr);
+			progress.start_range(worker_number, table);
+
+			while (!finished) {
+				sync_queue.check_aborted(); // check each iteration, rather than wait until the end of the current table; this is a good place to do it since it's likely we'll have no work to do for a short while
+
+				verb_t verb;
+				input >> verb;
+				table_metrics.round_trips++;
+				TraceScope trace("command", command_name(verb), table.name);
+
+				switch (verb) {
+					case Commands::HASH_NEXT:
+						handle_hash_next_command(table);
+						table_metrics.hash_commands++;
+						break;
+
+					case Commands::HASH_FAIL:
+						handle_hash_fail_command(table);
+						table_metrics.hash_commands++;
+						break;
+
+					case Commands::ROWS:
+						finished = handle_rows_command(table, row_applier);
+						table_metrics.rows_commands++;
+						break;
+
+					case Commands::ROWS_AND_HASH_NEXT:
+						handle_rows_and_hash_next_command(table, row_applier);
+						table_metrics.hash_commands++;
+						table_metrics.rows_commands++;
+						break;
+
+					case Commands::ROWS_AND_HASH_FAIL:
+						handle_rows_and_hash_fail_command(table, row_applier);
+						table_metrics.hash_commands++;
+						table_metrics.rows_commands++;
+						break;
+
+					default:
+						throw command_error("Unknown command " + to_string(verb));
+				}
+			}
 
-		while (!finished) {
-			sync_queue.check_aborted(); // check each iteration, rather than wait until the end of the current table; this is a good place to do it since it's likely we'll have no work to do for a short while
+			// apply the final batch and rebuild any deferred keys before we commit
+			row_applier.finish();
 
-			verb_t verb;
-			input >> verb;
+			// we won't have another turn in which we could hand over part of the range
+			sync_queue.remove_range(range);
 
-			switch (verb) {
-				case Commands::HASH_NEXT:
-					handle_hash_next_command(table);
-					hash_commands++;
-					break;
+			rows_changed = row_applier.rows_changed;
+			rows_affected = row_applier.rows_affected();
+			range_shared = row_applier.range_shared;
+			current_row_applier = nullptr;
+			current_range = nullptr;
+		} catch (...) {
+			// the range is going out of scope, so make sure no other worker is still waiting on us or looking at it
+			sync_queue.remove_range(range);
 
-				case Commands::HASH_FAIL:
-					handle_hash_fail_command(table);
-					hash_commands++;
-					break;
+			// the metrics are written even if we abort, and the table we were working on is usually the interesting one
+			record_range_metrics(table_metrics, started_at, bytes_sent_before, bytes_received_before, read_wait_before);
+			throw;
+		}
 
-				case Commands::ROWS:
-					finished = handle_rows_command(table, row_applier);
-					rows_commands++;
-					break;
+		if (verbose) {
+			time_t now = time(nullptr);
+			unique_lock<mutex> lock(sync_queue.mutex);
+			cout << "finished " << table.name << (start_after_key || !range.end_key.empty() ? " range" : "") << " in " << (now - started) << "s using " << table_metrics.hash_commands << " hash commands and " << table_metrics.rows_commands << " rows commands changing " << rows_changed << " rows" << endl << flush;
+		}
 
-				case Commands::ROWS_AND_HASH_NEXT:
-					handle_rows_and_hash_next_command(table, row_applier);
-					hash_commands++;
-					rows_commands++;
-					break;
+		if (commit_level >= CommitLevel::tables) {
+			commit();
+			client.start_write_transaction();
+		}
 
-				case Commands::ROWS_AND_HASH_FAIL:
-					handle_rows_and_hash_fail_command(table, row_applier);
-					hash_commands++;
-					rows_commands++;
-					break;
+		size_t table_rows_affected;
+		if (sync_queue.finish_range(range, rows_affected, table_rows_affected)) {
+			// we were the last to finish the table.  if it was split between workers, it's up to us to do what each
+			// worker's row applier would otherwise have done for the whole table.
+			if (range_shared) ResetTableSequences<DatabaseClient>::execute(client, table);
 
-				default:
-					throw command_error("Unknown command " + to_string(verb));
+			// statistics can only be refreshed once the changes have been committed, and on mysql ANALYZE TABLE would
+			// commit our transaction anyway, so unless we're committing after each table, we do it at the end
+			bool stale = statistics_stale(table, table_rows_affected);
+			if (commit_level >= CommitLevel::tables && (range_shared || stale)) {
+				commit();
+				if (stale) analyze_table(table, table_metrics);
+				client.start_write_transaction();
+			} else if (stale) {
+				tables_to_analyze.push_back(make_pair(&table, metrics.tables.size()));
 			}
 		}
 
+		progress.update(worker_number, string(), rows_since_progress_update, output_stream.bytes_written + input_stream.bytes_read);
+		progress.finish_range(worker_number);
+		rows_since_progress_update = 0;
+
+		record_range_metrics(table_metrics, started_at, bytes_sent_before, bytes_received_before, read_wait_before);
+	}
+
+	void record_range_metrics(SyncMetrics &table_metrics, chrono::steady_clock::time_point started_at, uint64_t bytes_sent_before, uint64_t bytes_received_before, chrono::steady_clock::duration read_wait_before) {
+		table_metrics.elapsed_seconds = seconds_since(started_at);
+		table_metrics.bytes_sent = output_stream.bytes_written - bytes_sent_before;
+		table_metrics.bytes_received = input_stream.bytes_read - bytes_received_before;
+		table_metrics.network_wait_seconds = chrono::duration<double>(input_stream.read_wait - read_wait_before).count();
+		metrics.totals += table_metrics;
+		metrics.tables.push_back(table_metrics);
+		range_metrics = nullptr;
+	}
+
+	void start_turn(const Table &table, const ColumnValues &last_key_in_play) {
+		// called at the start of each of our turns, when all the keys we and the other end are working on are
+		// <= last_key_in_play
+		update_progress(table, last_key_in_play);
+		offer_split(table, last_key_in_play);
+	}
+
+	void update_progress(const Table &table, const ColumnValues &last_key_in_play) {
+		// there can be many turns a second, so we only pass on our progress occasionally
+		time_t now = time(nullptr);
+		if (now == progress_updated) return;
+		progress_updated = now;
+		progress.update(worker_number, last_key_in_play.empty() ? string() : values_list(client, table, last_key_in_play), rows_since_progress_update, output_stream.bytes_written + input_stream.bytes_read);
+		rows_since_progress_update = 0;
+	}
+
+	void offer_split(const Table &table, const ColumnValues &last_key_in_play) {
+		// if another worker has asked to take over the rest of our range, we can split it after any key later than
+		// last_key_in_play without either end having to unwind anything
+		if (!current_range->splittable || !sync_queue.split_requested(*current_range)) return;
+
+		ColumnValues split_key;
+		if (last_key_in_play.empty() || current_row_applier->keys_deferred || !choose_split_key(table, last_key_in_play, split_key)) {
+			sync_queue.reject_split(*current_range);
+			return;
+		}
+
+		sync_queue.accept_split(*current_range, split_key);
+		current_row_applier->end_key = split_key;
+		current_row_applier->range_shared = true;
+		send_command(output, Commands::END_KEY, split_key);
+
 		if (verbose) {
-			time_t now = time(nullptr);
 			unique_lock<mutex> lock(sync_queue.mutex);
-			cout << "finished " << table.name << " in " << (now - started) << "s using " << hash_commands << " hash commands and " << rows_commands << " rows commands changing " << row_applier.rows_changed << " rows" << endl << flush;
+			cout << "handing over " << table.name << " after " << values_list(client, table, split_key) << endl << flush;
 		}
+	}
 
-		if (commit_level >= CommitLevel::tables) {
-			commit();
-			client.start_write_transaction();
+	bool choose_split_key(const Table &table, const ColumnValues &last_key_in_play, ColumnValues &split_key) {
+		// split the rest of our range in half by row count, if it's big enough to be worth sharing.  we only look up
+		// keys, and don't count more than a bounded number of rows, since this holds up our turn.
+		if (!retrieve_key_after_rows(split_key, table, last_key_in_play, ColumnValues(), 2*thresholds.minimum_rows_to_share)) return false;
+		if (retrieve_key_after_rows(split_key, table, last_key_in_play, ColumnValues(), 2*MAXIMUM_ROWS_TO_KEEP_WHEN_SHARING)) {
+			return retrieve_key_after_rows(split_key, table, last_key_in_play, ColumnValues(), MAXIMUM_ROWS_TO_KEEP_WHEN_SHARING);
 		}
+
+		size_t rows_remaining = count_rows(table, last_key_in_play, ColumnValues());
+		return retrieve_key_after_rows(split_key, table, last_key_in_play, ColumnValues(), rows_remaining/2);
+	}
+
+	DatabaseClient &read_client() {
+		return current_row_applier ? current_row_applier->read_client() : client;
+	}
+
+	template <typename RowReceiver>
+	inline size_t retrieve_rows(RowReceiver &row_receiver, const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key, ssize_t row_count = NO_ROW_COUNT_LIMIT) {
+		// an empty last_key means the end of the range we're working on, which is the end of the table unless we've
+		// shared the table with other workers
+		const ColumnValues &range_last_key(last_key.empty() && current_range ? current_range->end_key : last_key);
+		TraceScope trace("db", "retrieve_rows", table.name);
+		if (!range_metrics) return read_client().retrieve_rows(row_receiver, table, prev_key, range_last_key, row_count);
+
+		// timing each row costs a little, so we only separate the hashing time out if we've been asked for metrics
+		chrono::steady_clock::time_point started(chrono::steady_clock::now());
+		double hash_seconds = 0;
+		size_t rows;
+		if (collect_metrics) {
+			TimedRowReceiver<RowReceiver> timed_row_receiver(row_receiver, hash_seconds);
+			rows = read_client().retrieve_rows(timed_row_receiver, table, prev_key, range_last_key, row_count);
+		} else {
+			rows = read_client().retrieve_rows(row_receiver, table, prev_key, range_last_key, row_count);
+		}
+		range_metrics->read_seconds += seconds_since(started) - hash_seconds;
+		range_metrics->hash_seconds += hash_seconds;
+		return rows;
+	}
+
+	inline size_t count_rows(const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key) {
+		TraceScope trace("db", "count_rows", table.name);
+		chrono::steady_clock::time_point started(chrono::steady_clock::now());
+		size_t rows = read_client().count_rows(table, prev_key, last_key.empty() && current_range ? current_range->end_key : last_key);
+		if (range_metrics) range_metrics->read_seconds += seconds_since(started);
+		return rows;
+	}
+
+	inline bool retrieve_key_after_rows(ColumnValues &key, const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key, size_t rows) {
+		TraceScope trace("db", "retrieve_key_after_rows", table.name);
+		chrono::steady_clock::time_point started(chrono::steady_clock::now());
+		bool found = read_client().retrieve_key_after_rows(key, table, prev_key, last_key.empty() && current_range ? current_range->end_key : last_key, rows);
+		if (range_metrics) range_metrics->read_seconds += seconds_since(started);
+		return found;
+	}
+
+	inline void range_hashed(size_t rows, bool matched) {
+		if (range_metrics) range_metrics->hashed_ranges.add(rows);
+		if (matched) rows_since_progress_update += rows;
+	}
+
+	inline void range_applied(size_t rows) {
+		if (range_metrics) range_metrics->rows_ranges.add(rows);
+		rows_since_progress_update += rows;
+	}
+
+	bool table_empty(const Table &table) {
+		RowCounter row_counter;
+		retrieve_rows(row_counter, table, ColumnValues(), ColumnValues(), 1);
+		return (row_counter.row_count == 0);
 	}
 
 	void handle_hash_next_command(const Table &table) {
@@ -305,6 +669,7 @@ struct SyncToWorker {
 		if (verbose >= VERY_VERBOSE) cout << "-> hash " << table.name << ' ' << values_list(client, table, prev_key) << ' ' << values_list(client, table, last_key) << endl;
 
 		// after each hash command received it's our turn to send the next command
+		start_turn(table, last_key);
 		check_hash_and_choose_next_range(*this, table, nullptr, prev_key, last_key, nullptr, hash, target_block_size);
 	}
 
@@ -317,18 +682,20 @@ struct SyncToWorker {
 		if (verbose >= VERY_VERBOSE) cout << "-> hash " << table.name << ' ' << values_list(client, table, prev_key) << ' ' << values_list(client, table, last_key) << " last-failure " << values_list(client, table, failed_last_key) << endl;
 
 		// after each hash command received it's our turn to send the next command
+		start_turn(table, failed_last_key);
 		check_hash_and_choose_next_range(*this, table, nullptr, prev_key, last_key, &failed_last_key, hash, target_block_size);
 	}
 
 	bool handle_rows_command(const Table &table, TableRowApplier<DatabaseClient> &row_applier) {
-		// we're being sent a range of rows; apply them to our end.  we do this in-context to
-		// provide flow control - if we buffered and used a separate apply thread, we would
-		// bloat up if this end couldn't write to disk as quickly as the other end sent data.
+		// we're being sent a range of rows; apply them to our end.  normally we do this in-context
+		// to provide flow control; if the background applier is used, the amount of changes it
+		// queues up is bounded, so we still won't bloat up if this end can't write to disk as
+		// quickly as the other end sends data.
 		ColumnValues prev_key, last_key;
 		read_array(input, prev_key, last_key); // the first array gives the range arguments, which is followed by one array for each row
 		if (verbose >= VERY_VERBOSE) cout << "-> rows " << table.name << ' ' << values_list(client, table, prev_key) << ' ' << values_list(client, table, last_key) << endl;
 
-		row_applier.stream_from_input(input, prev_key, last_key);
+		range_applied(row_applier.stream_from_input(input, prev_key, last_key));
 
 		// if the range extends to the end of their table, that means we're done with this table;
 		// otherwise, rows commands are immediately followed by another command
@@ -350,8 +717,9 @@ struct SyncToWorker {
 		// fit the command we send back in the kernel send buffer to guarantee there is no
 		// deadlock; it's never been smaller than a page on any supported OS, and has been
 		// defaulted to much larger values for some years.
+		start_turn(table, next_key);
 		check_hash_and_choose_next_range(*this, table, nullptr, last_key, next_key, nullptr, hash, target_block_size);
-		row_applier.stream_from_input(input, prev_key, last_key);
+		range_applied(row_applier.stream_from_input(input, prev_key, last_key));
 		// nb. it's implied last_key is not [], as we would have been sent back a plain rows command for the combined range if that was needed
 	}
 
@@ -364,8 +732,9 @@ struct SyncToWorker {
 		if (verbose >= VERY_VERBOSE) cout << "-> hash " << table.name << ' ' << values_list(client, table, last_key) << ' ' << values_list(client, table, next_key) << " last-failure " << values_list(client, table, failed_last_key) << endl;
 
 		// same pipelining as the previous case
+		start_turn(table, failed_last_key);
 		check_hash_and_choose_next_range(*this, table, nullptr, last_key, next_key, &failed_last_key, hash, target_block_size);
-		row_applier.stream_from_input(input, prev_key, last_key);
+		range_applied(row_applier.stream_from_input(input, prev_key, last_key));
 	}
 
 	inline void send_hash_next_command(const Table &table, const ColumnValues &prev_key, const ColumnValues &last_key, const string &hash) {
@@ -397,9 +766,12 @@ struct SyncToWorker {
 
 	void commit() {
 		time_t started = time(nullptr);
+		chrono::steady_clock::time_point started_at(chrono::steady_clock::now());
 
 		client.commit_transaction();
 
+		(range_metrics ? *range_metrics : metrics.totals).commit_seconds += seconds_since(started_at);
+
 		if (verbose && commit_level < CommitLevel::tables) {
 			time_t now = time(nullptr);
 			unique_lock<mutex> lock(sync_queue.mutex);
@@ -407,6 +779,37 @@ struct SyncToWorker {
 		}
 	}
 
+	bool statistics_stale(const Table &table, size_t rows_affected) {
+		return (rows_affected >= thresholds.analyze_after_rows_changed && rows_affected*100 >= table.estimated_rows*ANALYZE_AFTER_PERCENT_CHANGED);
+	}
+
+	void analyze_table(const Table &table, SyncMetrics &table_metrics) {
+		time_t started = time(nullptr);
+		chrono::steady_clock::time_point started_at(chrono::steady_clock::now());
+
+		client.analyze_table(table);
+
+		table_metrics.tables_analyzed++;
+		table_metrics.analyze_seconds += seconds_since(started_at);
+
+		if (verbose) {
+			time_t now = time(nullptr);
+			unique_lock<mutex> lock(sync_queue.mutex);
+			cout << "analyzed " << table.name << " in " << (now - started) << "s" << endl << flush;
+		}
+	}
+
+	void analyze_tables() {
+		// each worker refreshes the statistics of the tables it changed, so they're analyzed in parallel
+		for (const pair<const Table*, size_t> &table_to_analyze : tables_to_analyze) {
+			SyncMetrics &table_metrics(metrics.tables[table_to_analyze.second]);
+			double analyze_seconds_before = table_metrics.analyze_seconds;
+			analyze_table(*table_to_analyze.first, table_metrics);
+			metrics.totals.tables_analyzed++;
+			metrics.totals.analyze_seconds += table_metrics.analyze_seconds - analyze_seconds_before;
+		}
+	}
+
 	void rollback() {
 		time_t started = time(nullptr);
 
@@ -429,6 +832,8 @@ struct SyncToWorker {
 
 	Database &database;
 	SyncQueue &sync_queue;
+	SyncProgress &progress;
+	size_t worker_number;
 	bool leader;
 	FDWriteStream output_stream;
 	FDReadStream input_stream;
@@ -442,28 +847,61 @@ struct SyncToWorker {
 	bool snapshot;
 	bool alter;
 	CommitLevel commit_level;
+	bool binary_key_order;
+	SyncThresholds thresholds;
 
 	int protocol_version;
 	size_t target_block_size;
+	unique_ptr<ApplyQueue> apply_queue;
+	unique_ptr<DatabaseClient> read_connection;
+	TableRowApplier<DatabaseClient> *current_row_applier;
+	TableRange *current_range;
+	bool collect_metrics;
+	WorkerMetrics metrics;
+	SyncMetrics *range_metrics;
+	vector<pair<const Table*, size_t>> tables_to_analyze; // and the index of their entry in metrics.tables
+	uint64_t rows_since_progress_update;
+	time_t progress_updated;
 	std::thread worker_thread;
 };
 
 template <typename DatabaseClient, typename... Options>
-void sync_to(int num_workers, int startfd, const Options &...options) {
+void sync_to(int num_workers, int startfd, const string &metrics_file, bool show_progress, const Options &...options) {
+	const int PROGRESS_INTERVAL = 10; // seconds
+
 	Database database;
 	SyncQueue sync_queue(num_workers);
+	SyncProgress progress(num_workers);
 	vector<SyncToWorker<DatabaseClient>*> workers;
 
 	workers.resize(num_workers);
 
 	for (int worker = 0; worker < num_workers; worker++) {
-		bool leader = (worker == 0);
 		int read_from_descriptor = startfd + worker;
 		int write_to_descriptor = startfd + worker + num_workers;
-		workers[worker] = new SyncToWorker<DatabaseClient>(database, sync_queue, leader, read_from_descriptor, write_to_descriptor, options...);
+		workers[worker] = new SyncToWorker<DatabaseClient>(database, sync_queue, progress, worker, read_from_descriptor, write_to_descriptor, options..., !metrics_file.empty());
+	}
+
+	// tell the user how we're getting on every so often until the workers are done
+	while (show_progress && progress.wait(chrono::seconds(PROGRESS_INTERVAL))) {
+		string report(progress.report());
+		unique_lock<mutex> lock(sync_queue.mutex);
+		cout << report << endl << flush;
 	}
 
-	for (SyncToWorker<DatabaseClient>* worker : workers) delete worker;
+	vector<WorkerMetrics> worker_metrics;
+	for (SyncToWorker<DatabaseClient>* worker : workers) {
+		worker->worker_thread.join();
+		worker_metrics.push_back(worker->metrics);
+		delete worker;
+	}
+
+	// write the metrics even if we're aborting, since they may show why
+	if (!metrics_file.empty()) {
+		ofstream os(metrics_file.c_str());
+		write_metrics_json(os, worker_metrics);
+		if (!os) cerr << "Couldn't write metrics to " << metrics_file << endl;
+	}
 
 	if (sync_queue.aborted) throw sync_error();
 }
@@ -4,6 +4,12 @@
 #include "database_client_traits.h"
 #include "sql_functions.h"
 #include "unique_key_clearer.h"
+#include "schema_matcher.h"
+#include "apply_queue.h"
+#include "sync_metrics.h"
+#include "row_serialization.h"
+#include "sync_thresholds.h"
+#include "trace.h"
 
 typedef map<PackedRow, PackedRow> RowsByPrimaryKey;
 
@@ -20,7 +26,8 @@ template <typename DatabaseClient>
 struct RowLoader {
 	RowLoader(const Table &table, RowsByPrimaryKey &rows): table(table), rows(rows) {}
 
-	void operator()(const typename DatabaseClient::RowType &database_row) {
+	template <typename DatabaseRow>
+	void operator()(const DatabaseRow &database_row) {
 		PackedRow row;
 		database_row.pack_row_into(row);
 		rows[primary_key(table, row)] = row;
@@ -37,7 +44,7 @@ void append_row_tuple(DatabaseClient &client, const Columns &columns, BaseSQL &s
 		if (n > 0) {
 			sql += ',';
 		}
-		sql += encode(client, columns[n], row[n]);
+		append_encoded(client, sql.curr, columns[n], row[n]);
 	}
 }
 
@@ -125,6 +132,10 @@ struct Replacer<DatabaseClient, true> {
 
 template <typename DatabaseClient, bool = is_base_of<SequenceColumns, DatabaseClient>::value>
 struct ResetTableSequences {
+	static bool required(const Table &table) {
+		return false;
+	}
+
 	static void execute(DatabaseClient &client, const Table &table) {
 		/* nothing required */
 	}
@@ -132,6 +143,13 @@ struct ResetTableSequences {
 
 template <typename DatabaseClient>
 struct ResetTableSequences <DatabaseClient, true> {
+	static bool required(const Table &table) {
+		for (const Column &column : table.columns) {
+			if (column.default_type == DefaultType::sequence) return true;
+		}
+		return false;
+	}
+
 	static void execute(DatabaseClient &client, const Table &table) {
 		for (const Column &column : table.columns) {
 			if (column.default_type == DefaultType::sequence) {
@@ -151,30 +169,210 @@ struct ResetTableSequences <DatabaseClient, true> {
 	}
 };
 
+// databases with transactional DDL can drop and recreate keys inside the sync transaction; on others, DDL implicitly
+// commits, so we only do it if the user has allowed us to commit as we go, and make the commit explicit
+template <typename DatabaseClient, bool = is_base_of<TransactionalDDL, DatabaseClient>::value>
+struct ExecuteDDLStatements {
+	static bool permitted(bool commit_often) {
+		return commit_often;
+	}
+
+	static void execute(DatabaseClient &client, const Statements &statements) {
+		client.commit_transaction();
+		for (const string &statement : statements) {
+			client.execute(statement);
+		}
+		client.start_write_transaction();
+	}
+};
+
+template <typename DatabaseClient>
+struct ExecuteDDLStatements <DatabaseClient, true> {
+	static bool permitted(bool commit_often) {
+		return true;
+	}
+
+	static void execute(DatabaseClient &client, const Statements &statements) {
+		for (const string &statement : statements) {
+			client.execute(statement);
+		}
+	}
+};
+
+// databases that can build keys without blocking writes can do so outside the transaction, but only if we're allowed
+// to commit as we go; otherwise they're rebuilt just like they were dropped
+template <typename DatabaseClient, bool = is_base_of<SupportsCreateKeysConcurrently, DatabaseClient>::value>
+struct RebuildKeys {
+	static void execute(DatabaseClient &client, const Table &table, const Keys &keys, bool commit_often) {
+		Statements statements;
+		for (const Key &key : keys) {
+			CreateKeyStatements<DatabaseClient>::add_to(statements, client, table, key);
+		}
+		ExecuteDDLStatements<DatabaseClient>::execute(client, statements);
+	}
+};
+
+template <typename DatabaseClient>
+struct RebuildKeys <DatabaseClient, true> {
+	static void execute(DatabaseClient &client, const Table &table, const Keys &keys, bool commit_often) {
+		if (!commit_often) {
+			RebuildKeys<DatabaseClient, false>::execute(client, table, keys, commit_often);
+			return;
+		}
+
+		Statements statements;
+		for (const Key &key : keys) {
+			CreateKeyStatements<DatabaseClient>::add_to(statements, client, table, key, true);
+		}
+		client.commit_transaction();
+		for (const string &statement : statements) {
+			client.execute(statement);
+		}
+		client.start_write_transaction();
+	}
+};
+
+// when applying changes in the background, rows are handed over to the applier thread in batches of about this
+// many bytes, and we stop reading more rows once this many bytes of changes are waiting to be applied
+const size_t BACKGROUND_APPLY_BATCH_SIZE = 1024*1024;
+const size_t BACKGROUND_APPLY_QUEUE_SIZE = 2*BaseSQL::MAX_SENSIBLE_INSERT_COMMAND_SIZE;
+
+struct RowChange {
+	RowChange(PackedRow &&row, bool exists, bool end_of_table, bool clear): row(std::move(row)), exists(exists), end_of_table(end_of_table), clear(clear) {}
+
+	PackedRow row;
+	bool exists;
+	bool end_of_table;
+	bool clear;
+};
+
+typedef vector<RowChange> RowChanges;
+
 template <typename DatabaseClient>
 struct TableRowApplier {
-	TableRowApplier(DatabaseClient &client, const Table &table, bool commit_often):
+	TableRowApplier(DatabaseClient &client, const Table &table, bool commit_often, const SyncThresholds &thresholds, ApplyQueue *apply_queue = nullptr, DatabaseClient *read_connection = nullptr):
 		client(client),
+		read_connection(read_connection),
 		table(table),
 		replacer(client, table),
 		commit_often(commit_often),
-		rows_changed(0) {
+		thresholds(thresholds),
+		apply_queue(apply_queue),
+		pending_bytes(0),
+		rows_changed(0),
+		rows_range_deleted(0),
+		keys_deferred(false),
+		range_shared(false),
+		metrics(nullptr) {
 	}
 
 	~TableRowApplier() {
+		// if finish() hasn't been called, we're aborting, so don't try to apply any more changes (which may fail
+		// again, and can't be reported from here), but make sure the applier thread isn't still using us
+		if (apply_queue) apply_queue->discard();
+	}
+
+	void finish() {
+		// apply the final batch, rebuild any keys we dropped, and reset the sequences; must be called once all the
+		// table's rows have been received, and may throw if any of that (or any change still queued) fails
+		if (apply_queue) {
+			submit_pending_changes();
+			apply_queue->push(bind(&TableRowApplier<DatabaseClient>::finish_table, this), 0);
+			apply_queue->wait_until_idle();
+		} else {
+			finish_table();
+		}
+	}
+
+	void finish_table() {
 		apply();
 
-		// reset sequences on those databases that don't automatically bump the high-water mark for inserts
-		ResetTableSequences<DatabaseClient>::execute(client, table);
+		chrono::steady_clock::time_point started(chrono::steady_clock::now());
+
+		// rebuild any keys we dropped while loading
+		if (!deferred_keys.empty()) {
+			TraceScope trace("apply", "rebuild_keys", table.name);
+			RebuildKeys<DatabaseClient>::execute(client, table, deferred_keys, commit_often);
+		}
+
+		// reset sequences on those databases that don't automatically bump the high-water mark for inserts; if other
+		// workers are synchronizing other parts of the table, the last one to finish does this instead
+		if (!range_shared) {
+			ResetTableSequences<DatabaseClient>::execute(client, table);
+		}
+
+		if (metrics) metrics->apply_seconds += seconds_since(started);
 	}
 
 	void apply() {
+		chrono::steady_clock::time_point started(chrono::steady_clock::now());
+
 		replacer.apply();
 
 		if (commit_often) {
 			client.commit_transaction();
 			client.start_write_transaction();
 		}
+
+		if (metrics) metrics->apply_seconds += seconds_since(started);
+	}
+
+	void defer_keys() {
+		// when we're loading a whole table, or a large part of it, it's much cheaper to build the secondary keys
+		// once at the end than to maintain them row-by-row.  unique keys are left in place so any conflicts are
+		// reported just as they would be normally.  we can't do this if other workers are also writing to the table,
+		// as the DDL would block them until we commit.
+		if (keys_deferred || range_shared || !ExecuteDDLStatements<DatabaseClient>::permitted(commit_often)) return;
+		keys_deferred = true;
+
+		Statements drop_key_statements;
+		for (const Key &key : table.keys) {
+			if (!key.unique) {
+				DropKeyStatements<DatabaseClient>::add_to(drop_key_statements, client, table, key);
+				deferred_keys.push_back(key);
+			}
+		}
+
+		if (drop_key_statements.empty()) return;
+
+		if (apply_queue) {
+			submit_pending_changes();
+			apply_queue->push(bind(&TableRowApplier<DatabaseClient>::drop_keys, this, drop_key_statements), 0);
+		} else {
+			drop_keys(drop_key_statements);
+		}
+	}
+
+	void drop_keys(const Statements &drop_key_statements) {
+		TraceScope trace("apply", "drop_keys", table.name);
+		ExecuteDDLStatements<DatabaseClient>::execute(client, drop_key_statements);
+	}
+
+	void wait_for_writes() {
+		if (apply_queue) {
+			submit_pending_changes();
+			apply_queue->wait_until_idle();
+		}
+	}
+
+	size_t rows_affected() {
+		// the range deletes are counted by the applier thread, so wait for it to run them
+		wait_for_writes();
+		return rows_changed + rows_range_deleted;
+	}
+
+	DatabaseClient &read_client() {
+		// when changes are applied in the background, we read from a separate connection so that hashing and
+		// comparing rows isn't held up by the writes.  that connection doesn't see the changes we haven't committed,
+		// but nothing depends on seeing those: even when applying in-context, changes are batched up and only
+		// executed every few MB, so later ranges have always been hashed and compared without them.
+		//
+		// once we've dropped keys, though, the connection that made the changes may hold locks until it commits
+		// that would block the other connection's reads (and then we would never get to commit), so from then on
+		// we read using the main connection once the applier thread has caught up.
+		if (read_connection && !keys_deferred) return *read_connection;
+		wait_for_writes();
+		return client;
 	}
 
 	template <typename InputStream>
@@ -184,12 +382,13 @@ struct TableRowApplier {
 		RowsByPrimaryKey existing_rows;
 
 		if (last_not_matching_key.empty()) {
-			// if the range is to the end of the table, clear all remaining rows at our end
-			delete_range(matched_up_to_key, last_not_matching_key);
+			// if the range is to the end of the table, clear all remaining rows at our end; if another worker is
+			// synchronizing the rest of the table, this means the end of our part of it
+			delete_range(matched_up_to_key, end_key);
 		} else {
 			// otherwise, load our rows in the range so we can compare them
 			RowLoader<DatabaseClient> row_loader(table, existing_rows);
-			client.retrieve_rows(row_loader, table, matched_up_to_key, last_not_matching_key);
+			read_client().retrieve_rows(row_loader, table, matched_up_to_key, last_not_matching_key);
 		}
 
 		PackedRow row;
@@ -204,29 +403,31 @@ struct TableRowApplier {
 
 			if (replace_row(existing_rows, row, last_not_matching_key.empty())) {
 				rows_changed++;
-
-				// to reduce the trips to the database server, we don't execute a statement for each row -
-				// but we do it periodically, as it's not efficient to build up enormous strings either
-				if (replacer.insert_sql.curr.size() > BaseSQL::MAX_SENSIBLE_INSERT_COMMAND_SIZE) {
-					apply();
-				}
 			}
 		}
 
 		// clear any remaining rows the other end didn't have
-		for (RowsByPrimaryKey::const_iterator it = existing_rows.begin(); it != existing_rows.end(); ++it) {
-			replacer.primary_key_clearer.row(it->second);
+		for (RowsByPrimaryKey::iterator it = existing_rows.begin(); it != existing_rows.end(); ++it) {
+			change_row(it->second, false, false, true);
 		}
 		rows_changed  += existing_rows.size();
 		rows_in_range += existing_rows.size();
 
+		// hand the changes for this range over now, so they're applied while we read the next command
+		submit_pending_changes();
+
+		// if this table has turned out to need a lot of changes, stop maintaining its keys as we go
+		if (rows_changed >= thresholds.defer_keys_after_rows_changed) {
+			defer_keys();
+		}
+
 		return rows_in_range;
 	}
 
-	bool replace_row(RowsByPrimaryKey &existing_rows, const PackedRow &row, bool end_of_table) {
+	bool replace_row(RowsByPrimaryKey &existing_rows, PackedRow &row, bool end_of_table) {
 		// if we're inserting the range to the end of the table, we know we need to insert this row
 		if (end_of_table) {
-			replacer.row(row, false, true);
+			change_row(row, false, true, false);
 			return true;
 		}
 
@@ -242,24 +443,118 @@ struct TableRowApplier {
 			if (matches) return false;
 
 			// row is different
-			replacer.row(row, true, false);
+			change_row(row, true, false, false);
 		} else {
 			// if we don't have this row, we need to insert it
-			replacer.row(row, false, false);
+			change_row(row, false, false, false);
 		}
 
 		return true;
 	}
 
+	void change_row(PackedRow &row, bool exists, bool end_of_table, bool clear) {
+		if (metrics) {
+			if (clear) {
+				metrics->rows_deleted++;
+			} else if (exists) {
+				metrics->rows_updated++;
+			} else {
+				metrics->rows_inserted++;
+			}
+		}
+
+		if (!apply_queue) {
+			write_change(row, exists, end_of_table, clear);
+			return;
+		}
+
+		// the row won't be used again at this end, so we can give it to the applier thread rather than copy it
+		for (const PackedValue &value : row) pending_bytes += value.size();
+		pending_changes.emplace_back(std::move(row), exists, end_of_table, clear);
+
+		if (pending_bytes >= BACKGROUND_APPLY_BATCH_SIZE) {
+			submit_pending_changes();
+		}
+	}
+
+	void write_change(const PackedRow &row, bool exists, bool end_of_table, bool clear) {
+		if (clear) {
+			replacer.primary_key_clearer.row(row);
+			return;
+		}
+
+		replacer.row(row, exists, end_of_table);
+
+		// to reduce the trips to the database server, we don't execute a statement for each row -
+		// but we do it periodically, as it's not efficient to build up enormous strings either
+		if (replacer.insert_sql.curr.size() > BaseSQL::MAX_SENSIBLE_INSERT_COMMAND_SIZE) {
+			apply();
+		}
+	}
+
+	void write_changes(const RowChanges &changes) {
+		for (const RowChange &change : changes) {
+			write_change(change.row, change.exists, change.end_of_table, change.clear);
+		}
+	}
+
+	void submit_pending_changes() {
+		if (pending_changes.empty()) return;
+		apply_queue->push(bind(&TableRowApplier<DatabaseClient>::write_changes, this, std::move(pending_changes)), pending_bytes);
+		pending_changes.clear();
+		pending_bytes = 0;
+	}
+
 	void delete_range(const ColumnValues &matched_up_to_key, const ColumnValues &last_not_matching_key) {
-		client.execute("DELETE FROM " + table.name + where_sql(client, table, matched_up_to_key, last_not_matching_key));
+		if (metrics) metrics->range_deletes++;
+
+		if (apply_queue) {
+			submit_pending_changes();
+			apply_queue->push(bind(&TableRowApplier<DatabaseClient>::execute_delete_range, this, matched_up_to_key, last_not_matching_key), 0);
+		} else {
+			execute_delete_range(matched_up_to_key, last_not_matching_key);
+		}
+	}
+
+	void execute_delete_range(const ColumnValues &matched_up_to_key, const ColumnValues &last_not_matching_key) {
+		chrono::steady_clock::time_point started(chrono::steady_clock::now());
+
+		// look up the key of every delete_range_chunk_rows'th row and delete up to it, committing in between if
+		// we're allowed to; the last statement deletes the rest of the range.  we read using the same connection, so
+		// we don't see rows that we've already deleted.
+		ColumnValues prev_key(matched_up_to_key), chunk_last_key;
+		while (client.retrieve_key_after_rows(chunk_last_key, table, prev_key, last_not_matching_key, thresholds.delete_range_chunk_rows)) {
+			client.execute("DELETE FROM " + table.name + where_sql(client, table, prev_key, chunk_last_key));
+			rows_range_deleted += thresholds.delete_range_chunk_rows;
+			prev_key = chunk_last_key;
+
+			if (commit_often) {
+				client.commit_transaction();
+				client.start_write_transaction();
+			}
+		}
+		rows_range_deleted += client.count_rows(table, prev_key, last_not_matching_key);
+		client.execute("DELETE FROM " + table.name + where_sql(client, table, prev_key, last_not_matching_key));
+
+		if (metrics) metrics->apply_seconds += seconds_since(started);
 	}
 
 	DatabaseClient &client;
+	DatabaseClient *read_connection;
 	const Table &table;
 	Replacer<DatabaseClient> replacer;
 	bool commit_often;
+	SyncThresholds thresholds;
+	ApplyQueue *apply_queue;
+	RowChanges pending_changes;
+	size_t pending_bytes;
 	size_t rows_changed;
+	size_t rows_range_deleted; // by the applier thread, if applying in the background
+	bool keys_deferred;
+	Keys deferred_keys;
+	ColumnValues end_key;
+	bool range_shared;
+	SyncMetrics *metrics; // if set, the applier thread adds to apply_seconds, and the worker thread to the row counts
 };
 
 #endif
@@ -0,0 +1,83 @@
+#include "trace.h"
+#include "json_string.h"
+
+#include <fstream>
+#include <mutex>
+#include <atomic>
+#include <stdexcept>
+#include <unistd.h>
+
+bool Trace::active = false;
+
+static ofstream trace_file;
+static std::mutex trace_mutex;
+static bool first_event = true;
+static pid_t trace_pid;
+static atomic<int> next_thread_id(1);
+static thread_local int thread_id = 0;
+
+static int current_thread_id() {
+	if (!thread_id) thread_id = next_thread_id++;
+	return thread_id;
+}
+
+// called with trace_mutex held
+static void begin_event(const char *phase, const char *category, const char *name, uint64_t timestamp) {
+	trace_file << (first_event ? "[\n" : ",\n");
+	first_event = false;
+	trace_file << "{\"ph\": \"" << phase << "\", \"cat\": \"" << category << "\", \"name\": ";
+	write_json_string(trace_file, name);
+	trace_file << ", \"pid\": " << trace_pid << ", \"tid\": " << current_thread_id() << ", \"ts\": " << timestamp;
+}
+
+void Trace::start(const string &filename, const string &process_name) {
+	std::unique_lock<std::mutex> lock(trace_mutex);
+	trace_file.open(filename.c_str(), ios::out | ios::trunc);
+	if (!trace_file) throw runtime_error("Couldn't open trace file " + filename);
+	trace_pid = getpid();
+	active = true;
+
+	begin_event("M", "__metadata", "process_name", 0);
+	trace_file << ", \"args\": {\"name\": ";
+	write_json_string(trace_file, process_name);
+	trace_file << "}}";
+}
+
+void Trace::finish() {
+	std::unique_lock<std::mutex> lock(trace_mutex);
+	if (!active) return;
+	active = false;
+	trace_file << "\n]\n";
+	trace_file.close();
+}
+
+void Trace::name_thread(const string &thread_name) {
+	if (!active) return;
+	std::unique_lock<std::mutex> lock(trace_mutex);
+	begin_event("M", "__metadata", "thread_name", 0);
+	trace_file << ", \"args\": {\"name\": ";
+	write_json_string(trace_file, thread_name);
+	trace_file << "}}";
+}
+
+void Trace::complete(const char *category, const char *name, uint64_t started, uint64_t finished, const string *table) {
+	std::unique_lock<std::mutex> lock(trace_mutex);
+	if (!active) return;
+	begin_event("X", category, name, started);
+	trace_file << ", \"dur\": " << finished - started;
+	if (table) {
+		trace_file << ", \"args\": {\"table\": ";
+		write_json_string(trace_file, *table);
+		trace_file << '}';
+	}
+	trace_file << '}';
+}
+
+void Trace::instant(const char *category, const char *name) {
+	if (!active) return;
+	uint64_t timestamp = now();
+	std::unique_lock<std::mutex> lock(trace_mutex);
+	if (!active) return;
+	begin_event("i", category, name, timestamp);
+	trace_file << ", \"s\": \"t\"}";
+}
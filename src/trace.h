@@ -0,0 +1,57 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+#include <chrono>
+#include <stdint.h>
+
+using namespace std;
+
+// records a timeline of what each thread is doing, in the Chrome trace event format, so that it can be loaded into
+// chrome://tracing or Perfetto to see where the endpoints are stalled waiting for each other.  each process writes its
+// own file; the timestamps are wall clock times and the events are labelled with the process ID, so the files from
+// both ends can be merged by concatenating their arrays.  when tracing is off, each event costs only a test.
+struct Trace {
+	static void start(const string &filename, const string &process_name);
+	static void finish();
+	static void name_thread(const string &thread_name);
+	static void complete(const char *category, const char *name, uint64_t started, uint64_t finished, const string *table = nullptr);
+	static void instant(const char *category, const char *name);
+
+	static inline bool enabled() { return active; }
+
+	static inline uint64_t now() {
+		return chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count();
+	}
+
+protected:
+	static bool active;
+};
+
+// traces to the given file, if any, until it goes out of scope
+struct TraceFile {
+	TraceFile(const string &filename, const string &process_name) {
+		if (!filename.empty()) Trace::start(filename, process_name);
+	}
+
+	~TraceFile() {
+		Trace::finish();
+	}
+};
+
+// records the time from construction to destruction as a single event
+struct TraceScope {
+	inline TraceScope(const char *category, const char *name, const string *table = nullptr): category(category), name(name), table(table), started(Trace::enabled() ? Trace::now() : 0) {}
+	inline TraceScope(const char *category, const char *name, const string &table): TraceScope(category, name, &table) {}
+
+	inline ~TraceScope() {
+		if (started) Trace::complete(category, name, started, Trace::now(), table);
+	}
+
+	const char *category;
+	const char *name;
+	const string *table;
+	uint64_t started;
+};
+
+#endif
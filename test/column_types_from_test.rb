@@ -40,4 +40,41 @@ class ColumnTypesFromTest < KitchenSync::EndpointTestCase
     expect_command Commands::ROWS,
                    [@keys[1], []]
   end
+
+  test_each "hashes a canonical form of the values that the databases format differently" do
+    clear_schema
+    create_misctbl
+
+    # the decimal is returned padded to the column's scale, and the fixed-length string may be returned padded with
+    # spaces depending on the database, but both are hashed without them; floating point values are hashed as doubles
+    execute "INSERT INTO misctbl VALUES (1, true, '2099-12-31', '01:02:03', '2014-04-13 01:02:03', 1.5, 0.25, 12.34, 'vartext', 'abc', 'sometext', 'test')"
+    canonical_row = [1, true, '2099-12-31', '01:02:03', '2014-04-13 01:02:03', 1.5, 0.25, '12.34', 'vartext', 'abc', 'sometext', 'test']
+
+    send_handshake_commands
+
+    send_command   Commands::OPEN, "misctbl"
+    expect_command Commands::HASH_NEXT,
+                   [[], [1], hash_of([canonical_row])]
+  end
+
+  test_each "hashes single precision values printed to different numbers of digits as the same value" do
+    clear_schema
+    create_misctbl
+
+    # mysql returns both of these as 3.14159 while postgresql returns both as 3.1415927, but each end rounds them
+    # to the digits that a float can always represent before hashing
+    execute "INSERT INTO misctbl (pri, floatfield) VALUES (1, 3.1415927), (2, 3.14159)"
+    canonical_rows = [[1, nil, nil, nil, nil, 3.14159, nil, nil, nil, nil, nil, nil],
+                      [2, nil, nil, nil, nil, 3.14159, nil, nil, nil, nil, nil, nil]]
+
+    send_handshake_commands
+
+    send_command   Commands::OPEN, "misctbl"
+    expect_command Commands::HASH_NEXT,
+                   [[], [1], hash_of(canonical_rows[0..0])]
+
+    send_command   Commands::HASH_NEXT, [], [2], hash_of(canonical_rows[0..1])
+    expect_command Commands::ROWS,
+                   [[2], []]
+  end
 end
@@ -4,6 +4,7 @@ require 'pp' # **
 
 class KitchenSyncSpawner
   STARTUP_TIMEOUT = 10 # seconds
+  WORKER_STARTFD = 3
   
   attr_reader :program_binary, :capture_stderr_in
   
@@ -11,6 +12,7 @@ class KitchenSyncSpawner
     @program_binary = program_binary
     @program_args = program_args
     @capture_stderr_in = options[:capture_stderr_in]
+    @workers = options[:workers] || 1
     raise "Can't see a program binary at #{program_binary}" unless File.executable?(program_binary)
   end
   
@@ -35,6 +37,15 @@ class KitchenSyncSpawner
     
     stdin_r, stdin_w = IO.pipe
     stdout_r, stdout_w = IO.pipe
+
+    # with more than one worker, each reads its commands from and writes its results to its own descriptors, which
+    # are numbered from WORKER_STARTFD up in the same way that ks numbers them, rather than using stdin and stdout
+    worker_input_pipes = @workers > 1 ? (0...@workers).collect { IO.pipe } : []
+    worker_output_pipes = @workers > 1 ? (0...@workers).collect { IO.pipe } : []
+    worker_descriptors = {}
+    worker_input_pipes.each_with_index {|(r, w), worker| worker_descriptors[WORKER_STARTFD + worker] = r}
+    worker_output_pipes.each_with_index {|(r, w), worker| worker_descriptors[WORKER_STARTFD + @workers + worker] = w}
+
     @child_pid = fork do
       begin
         stdin_w.close
@@ -46,19 +57,36 @@ class KitchenSyncSpawner
         puts e
         exit 1
       end
-      exec *exec_args
+      worker_descriptors.empty? ? exec(*exec_args) : exec(*exec_args, worker_descriptors)
     end
     stdin_r.close
     stdout_w.close
     @program_stdin = stdin_w
     @program_stdout = stdout_r
+    @pipes = [stdin_w, stdout_r]
+
+    unless worker_input_pipes.empty?
+      worker_input_pipes.each {|r, w| r.close}
+      worker_output_pipes.each {|r, w| w.close}
+      @worker_stdins = worker_input_pipes.collect {|r, w| w}
+      @worker_stdouts = worker_output_pipes.collect {|r, w| r}
+      @pipes.concat @worker_stdins + @worker_stdouts
+      @worker_unpackers = []
+      use_worker(0)
+    end
+  end
+
+  def use_worker(worker)
+    # subsequent commands are sent to and read from the given worker
+    @program_stdin = @worker_stdins[worker]
+    @program_stdout = @worker_stdouts[worker]
+    @unpacker = (@worker_unpackers[worker] ||= MessagePack::Unpacker.new(@program_stdout))
   end
   
   def stop_binary
     return unless @child_pid
     Process.kill('TERM', @child_pid) if @child_pid
-    @program_stdin.close unless @program_stdin.closed?
-    @program_stdout.close
+    @pipes.each {|io| io.close unless io.closed?}
     wait
     @unpacker = nil
   end
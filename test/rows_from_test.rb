@@ -120,6 +120,28 @@ class RowsFromTest < KitchenSync::EndpointTestCase
                    @rows[1]
   end
 
+  test_each "orders and compares string keys by their bytes after the binary_key_order command" do
+    create_some_tables
+    execute "INSERT INTO secondtbl VALUES (2, 2349174, 'ab', 1), (9, 968116383, 'Ba', 9), (100, 100, 'aa', 100)"
+    send_handshake_commands
+
+    send_command   Commands::BINARY_KEY_ORDER
+    expect_command Commands::BINARY_KEY_ORDER
+
+    # upper case letters sort before lower case letters in binary order, but not in the usual collations
+    send_command   Commands::ROWS, [], []
+    expect_command Commands::ROWS,
+                   [[], []],
+                   [  9, 968116383, "Ba",   9],
+                   [100,       100, "aa", 100],
+                   [  2,   2349174, "ab",   1]
+
+    send_command   Commands::ROWS, ["Ba", 9], ["aa", 100]
+    expect_command Commands::ROWS,
+                   [["Ba", 9], ["aa", 100]],
+                   [100,       100, "aa", 100]
+  end
+
   test_each "supports composite keys" do
     create_some_tables
     execute "INSERT INTO secondtbl VALUES (2, 2349174, 'xy', 1), (9, 968116383, 'aa', 9), (100, 100, 'aa', 100), (340, 363401169, 'ab', 20)"
@@ -173,4 +195,33 @@ class RowsFromTest < KitchenSync::EndpointTestCase
     expect_command Commands::ROWS,
                    [[], []]
   end
+
+  test_each "treats the given end key as the end of the table if another worker is handling the rest of it" do
+    create_some_tables
+    execute "INSERT INTO footbl VALUES (2, 10, 'test'), (4, NULL, 'foo'), (5, NULL, NULL), (8, -1, 'longer str')"
+    @rows = [[2,  10,       "test"],
+             [4, nil,        "foo"],
+             [5, nil,          nil],
+             [8,  -1, "longer str"]]
+    send_handshake_commands
+
+    send_command   Commands::SELECT_TABLE, "footbl"
+    send_command   Commands::END_KEY, [5]
+    send_command   Commands::ROWS, [2], []
+    expect_command Commands::ROWS,
+                   [[2], []],
+                   @rows[1],
+                   @rows[2]
+
+    send_command   Commands::ROWS, [5], [8] # explicit ranges are unaffected
+    expect_command Commands::ROWS,
+                   [[5], [8]],
+                   @rows[3]
+
+    send_command   Commands::SELECT_TABLE, "footbl" # selecting the table again starts a new range
+    send_command   Commands::ROWS, [2], []
+    expect_command Commands::ROWS,
+                   [[2], []],
+                   *@rows[1..3]
+  end
 end
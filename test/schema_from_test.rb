@@ -43,8 +43,11 @@ class SchemaFromTest < KitchenSync::EndpointTestCase
     clear_schema
     create_noprimarytbl(false)
 
+    send_handshake_commands
+
     expect_stderr("Couldn't find a primary or non-nullable unique key on table noprimarytbl") do
-      send_handshake_commands rescue nil
+      send_command Commands::SCHEMA
+      read_command rescue nil
     end
   end
 
@@ -58,6 +61,24 @@ class SchemaFromTest < KitchenSync::EndpointTestCase
                    [{"tables" => [defaultstbl_def]}]
   end
 
+  test_each "tells string defaults that look like SQL apart from having no default" do
+    clear_schema
+    execute "CREATE TABLE stringdefaultstbl (pri INT NOT NULL, nodefault VARCHAR(10), nullstring VARCHAR(10) DEFAULT 'NULL', quotedstring VARCHAR(10) DEFAULT '''x''', PRIMARY KEY(pri))"
+    send_handshake_commands
+
+    send_command   Commands::SCHEMA
+    expect_command Commands::SCHEMA,
+                   [{"tables" => [
+                     { "name"    => "stringdefaultstbl",
+                       "columns" => [
+                         {"name" => "pri",          "column_type" => ColumnTypes::SINT, "size" =>  4, "nullable" => false},
+                         {"name" => "nodefault",    "column_type" => ColumnTypes::VCHR, "size" => 10},
+                         {"name" => "nullstring",   "column_type" => ColumnTypes::VCHR, "size" => 10, "default_value" => "NULL"},
+                         {"name" => "quotedstring", "column_type" => ColumnTypes::VCHR, "size" => 10, "default_value" => "'x'"}],
+                       "primary_key_columns" => [0],
+                       "keys" => [] }]}]
+  end
+
   test_each "describes serial/auto_increment sequence columns" do
     clear_schema
     create_autotbl
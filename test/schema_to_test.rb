@@ -58,11 +58,14 @@ class SchemaToTest < KitchenSync::EndpointTestCase
     expect_handshake_commands
     expect_command Commands::SCHEMA
     send_command   Commands::SCHEMA, "tables" => [footbl_def, middletbl_def, secondtbl_def]
-    expect_command Commands::OPEN, ["footbl"]
+    expect_command Commands::SELECT_TABLE, ["footbl"]
+    expect_command Commands::ROWS, [[], []]
     send_command   Commands::ROWS, [], []
-    expect_command Commands::OPEN, ["middletbl"]
+    expect_command Commands::SELECT_TABLE, ["middletbl"]
+    expect_command Commands::ROWS, [[], []]
     send_command   Commands::ROWS, [], []
-    expect_command Commands::OPEN, ["secondtbl"]
+    expect_command Commands::SELECT_TABLE, ["secondtbl"]
+    expect_command Commands::ROWS, [[], []]
     send_command   Commands::ROWS, [], []
     expect_quit_and_close
   end
@@ -185,9 +188,11 @@ class SchemaToTest < KitchenSync::EndpointTestCase
     expect_handshake_commands
     expect_command Commands::SCHEMA
     send_command   Commands::SCHEMA, "tables" => [footbl_def, middletbl_def, secondtbl_def]
-    expect_command Commands::OPEN, ["middletbl"]
+    expect_command Commands::SELECT_TABLE, ["middletbl"]
+    expect_command Commands::ROWS, [[], []]
     send_command   Commands::ROWS, [], []
-    expect_command Commands::OPEN, ["secondtbl"]
+    expect_command Commands::SELECT_TABLE, ["secondtbl"]
+    expect_command Commands::ROWS, [[], []]
     send_command   Commands::ROWS, [], []
     read_command
   end
@@ -201,9 +206,11 @@ class SchemaToTest < KitchenSync::EndpointTestCase
     expect_handshake_commands
     expect_command Commands::SCHEMA
     send_command   Commands::SCHEMA, "tables" => [footbl_def, middletbl_def, secondtbl_def]
-    expect_command Commands::OPEN, ["footbl"]
+    expect_command Commands::SELECT_TABLE, ["footbl"]
+    expect_command Commands::ROWS, [[], []]
     send_command   Commands::ROWS, [], []
-    expect_command Commands::OPEN, ["secondtbl"]
+    expect_command Commands::SELECT_TABLE, ["secondtbl"]
+    expect_command Commands::ROWS, [[], []]
     send_command   Commands::ROWS, [], []
     read_command
   end
@@ -217,9 +224,11 @@ class SchemaToTest < KitchenSync::EndpointTestCase
     expect_handshake_commands
     expect_command Commands::SCHEMA
     send_command   Commands::SCHEMA, "tables" => [footbl_def, middletbl_def, secondtbl_def]
-    expect_command Commands::OPEN, ["footbl"]
+    expect_command Commands::SELECT_TABLE, ["footbl"]
+    expect_command Commands::ROWS, [[], []]
     send_command   Commands::ROWS, [], []
-    expect_command Commands::OPEN, ["middletbl"]
+    expect_command Commands::SELECT_TABLE, ["middletbl"]
+    expect_command Commands::ROWS, [[], []]
     send_command   Commands::ROWS, [], []
     read_command
   end
@@ -234,9 +243,11 @@ class SchemaToTest < KitchenSync::EndpointTestCase
     expect_handshake_commands
     expect_command Commands::SCHEMA
     send_command   Commands::SCHEMA, "tables" => [middletbl_def, secondtbl_def]
-    expect_command Commands::OPEN, ["middletbl"]
+    expect_command Commands::SELECT_TABLE, ["middletbl"]
+    expect_command Commands::ROWS, [[], []]
     send_command   Commands::ROWS, [], []
-    expect_command Commands::OPEN, ["secondtbl"]
+    expect_command Commands::SELECT_TABLE, ["secondtbl"]
+    expect_command Commands::ROWS, [[], []]
     send_command   Commands::ROWS, [], []
     read_command
   end
@@ -251,9 +262,11 @@ class SchemaToTest < KitchenSync::EndpointTestCase
     expect_handshake_commands
     expect_command Commands::SCHEMA
     send_command   Commands::SCHEMA, "tables" => [footbl_def, secondtbl_def]
-    expect_command Commands::OPEN, ["footbl"]
+    expect_command Commands::SELECT_TABLE, ["footbl"]
+    expect_command Commands::ROWS, [[], []]
     send_command   Commands::ROWS, [], []
-    expect_command Commands::OPEN, ["secondtbl"]
+    expect_command Commands::SELECT_TABLE, ["secondtbl"]
+    expect_command Commands::ROWS, [[], []]
     send_command   Commands::ROWS, [], []
     read_command
   end
@@ -268,9 +281,11 @@ class SchemaToTest < KitchenSync::EndpointTestCase
     expect_handshake_commands
     expect_command Commands::SCHEMA
     send_command   Commands::SCHEMA, "tables" => [footbl_def, middletbl_def]
-    expect_command Commands::OPEN, ["footbl"]
+    expect_command Commands::SELECT_TABLE, ["footbl"]
+    expect_command Commands::ROWS, [[], []]
     send_command   Commands::ROWS, [], []
-    expect_command Commands::OPEN, ["middletbl"]
+    expect_command Commands::SELECT_TABLE, ["middletbl"]
+    expect_command Commands::ROWS, [[], []]
     send_command   Commands::ROWS, [], []
     read_command
   end
@@ -728,7 +743,10 @@ SQL
     expect_handshake_commands
     expect_command Commands::SCHEMA
     send_command Commands::SCHEMA, "tables" => [secondtbl_def.merge("primary_key_columns" => [1, 2])]
-    read_command
+    expect_command Commands::SELECT_TABLE, ["secondtbl"]
+    expect_command Commands::ROWS, [[], []]
+    send_command   Commands::ROWS, [], []
+    expect_quit_and_close
     assert_equal [1, 2].collect {|index| secondtbl_def["columns"][index]["name"]}, connection.table_key_columns("secondtbl")[connection.table_primary_key_name("secondtbl")]
     assert_equal [], query("SELECT * FROM secondtbl")
   end
@@ -741,7 +759,10 @@ SQL
     expect_handshake_commands
     expect_command Commands::SCHEMA
     send_command Commands::SCHEMA, "tables" => [secondtbl_def.merge("primary_key_columns" => [2, 1, 3])]
-    read_command
+    expect_command Commands::SELECT_TABLE, ["secondtbl"]
+    expect_command Commands::ROWS, [[], []]
+    send_command   Commands::ROWS, [], []
+    expect_quit_and_close
     assert_equal [2, 1, 3].collect {|index| secondtbl_def["columns"][index]["name"]}, connection.table_key_columns("secondtbl")[connection.table_primary_key_name("secondtbl")]
     assert_equal [], query("SELECT * FROM secondtbl")
   end
@@ -754,7 +775,10 @@ SQL
     expect_handshake_commands
     expect_command Commands::SCHEMA
     send_command Commands::SCHEMA, "tables" => [secondtbl_def.merge("primary_key_columns" => [3, 2, 1])]
-    read_command
+    expect_command Commands::SELECT_TABLE, ["secondtbl"]
+    expect_command Commands::ROWS, [[], []]
+    send_command   Commands::ROWS, [], []
+    expect_quit_and_close
     assert_equal [3, 2, 1].collect {|index| secondtbl_def["columns"][index]["name"]}, connection.table_key_columns("secondtbl")[connection.table_primary_key_name("secondtbl")]
     assert_equal [], query("SELECT * FROM secondtbl")
   end
@@ -817,4 +841,40 @@ SQL
     assert_equal [secondtbl_def["columns"][3]["name"], secondtbl_def["columns"][1]["name"]], connection.table_key_columns("secondtbl")[key["name"]]
     assert_secondtbl_rows_present
   end
+
+  test_each "moves a key name from one table to another when running the schema changes on several workers" do
+    clear_schema
+    create_footbl
+    create_secondtbl
+    execute "CREATE INDEX movingkey ON footbl (another_col)"
+    program_args.concat ["", "", "2", KitchenSyncSpawner::WORKER_STARTFD.to_s] # ignore, only, workers, startfd
+    @workers = 2
+
+    # on postgresql key names are shared by all the tables in the schema, so the key has to be dropped from footbl
+    # before it can be created on secondtbl, although the two tables' changes could otherwise run on different workers
+    moved_secondtbl_def = secondtbl_def.merge("keys" => secondtbl_def["keys"] + [{"name" => "movingkey", "unique" => false, "columns" => [0]}])
+    [0, 1].each do |worker|
+      spawner.use_worker(worker)
+      expect_handshake_commands
+    end
+    spawner.use_worker(0)
+    expect_command Commands::SCHEMA
+    send_command   Commands::SCHEMA, "tables" => [footbl_def, moved_secondtbl_def]
+
+    # each worker then syncs one of the empty tables
+    [0, 1].each do |worker|
+      spawner.use_worker(worker)
+      assert_equal Commands::SELECT_TABLE, read_command.first
+      expect_command Commands::ROWS, [[], []]
+      send_command   Commands::ROWS, [], []
+    end
+    [0, 1].each do |worker|
+      spawner.use_worker(worker)
+      expect_quit_and_close
+    end
+
+    assert_equal [], connection.table_keys("footbl")
+    assert_equal %w(movingkey secidx), connection.table_keys("secondtbl").sort
+    assert_equal %w(tri), connection.table_key_columns("secondtbl")["movingkey"]
+  end
 end
@@ -21,6 +21,50 @@ class SyncToTest < KitchenSync::EndpointTestCase
     @keys = @rows.collect {|row| [row[0]]}
   end
 
+  # the 'to' end's options are positional, so this fills in the defaults for the ones the test doesn't set
+  def set_to_options(options = {})
+    program_args.concat [
+      "", "",                                              # ignore, only
+      (options[:workers] || 1).to_s,
+      options[:workers] ? KitchenSyncSpawner::WORKER_STARTFD.to_s : "0",
+      "0", "0", "0",                                       # verbose, snapshot, alter
+      options[:commit_level] || "1",
+      options[:apply_in_background] ? "1" : "0",
+      options[:metrics_file] || "",
+      "0",                                                 # progress
+      options[:trace_file] || "",
+      "0",                                                 # binary key order
+      options[:defer_keys_after_rows_changed] || "",
+      options[:delete_range_chunk_rows] || "",
+      options[:minimum_rows_to_share] || "",
+      options[:analyze_after_rows_changed] || ""]
+    @workers = options[:workers]
+  end
+
+  # runs the handshake with each of two workers and gives the schema with footbl and secondtbl, which are empty at the
+  # other end; each worker takes one of the tables, but which gets which is up to the scheduler, so this returns the
+  # number of the worker that took footbl and then that of the worker that took secondtbl
+  def start_workers_on_footbl_and_secondtbl
+    [0, 1].each do |worker|
+      spawner.use_worker(worker)
+      expect_handshake_commands
+    end
+    spawner.use_worker(0)
+    expect_command Commands::SCHEMA
+    send_command   Commands::SCHEMA, "tables" => [footbl_def, secondtbl_def]
+
+    first_commands = [0, 1].collect {|worker| spawner.use_worker(worker); read_command}
+    footbl_worker = first_commands.index([Commands::OPEN, ["footbl"]])
+    secondtbl_worker = 1 - footbl_worker
+    assert_equal [Commands::SELECT_TABLE, ["secondtbl"]], first_commands[secondtbl_worker]
+    [footbl_worker, secondtbl_worker]
+  end
+
+  # returns the path to write the named output file to, removing any left over from a previous test
+  def output_file(name)
+    File.join(File.dirname(__FILE__), 'tmp', name).tap {|path| File.unlink(path) if File.exist?(path)}
+  end
+
   test_each "is immediately sent all rows if the other end has an empty table, and finishes without needing to make any changes if the table is empty" do
     clear_schema
     create_footbl
@@ -28,7 +72,8 @@ class SyncToTest < KitchenSync::EndpointTestCase
     expect_handshake_commands
     expect_command Commands::SCHEMA
     send_command   Commands::SCHEMA, "tables" => [footbl_def]
-    expect_command Commands::OPEN, ["footbl"]
+    expect_command Commands::SELECT_TABLE, ["footbl"]
+    expect_command Commands::ROWS, [[], []]
     send_command   Commands::ROWS, [], []
     expect_quit_and_close
 
@@ -51,6 +96,39 @@ class SyncToTest < KitchenSync::EndpointTestCase
                  query("SELECT * FROM footbl ORDER BY col1")
   end
 
+  test_each "clears the table in chunks if the range to delete has more rows than the chunk size" do
+    clear_schema
+    setup_with_footbl
+    set_to_options :commit_level => "4", :delete_range_chunk_rows => "3"
+
+    expect_handshake_commands
+    expect_command Commands::SCHEMA
+    send_command   Commands::SCHEMA, "tables" => [footbl_def]
+    expect_command Commands::OPEN, ["footbl"]
+    send_command   Commands::ROWS, [], []
+    expect_quit_and_close
+
+    assert_equal [],
+                 query("SELECT * FROM footbl ORDER BY col1")
+  end
+
+  test_each "deletes only the rows in the range when they fill a whole number of chunks" do
+    setup_with_footbl
+    set_to_options :commit_level => "4", :delete_range_chunk_rows => "3"
+
+    expect_handshake_commands
+    expect_command Commands::SCHEMA
+    send_command   Commands::SCHEMA, "tables" => [footbl_def]
+    expect_command Commands::OPEN, ["footbl"]
+    send_command   Commands::HASH_NEXT, [], @keys[0], hash_of(@rows[0..0])
+    expect_command Commands::HASH_NEXT, [@keys[0], @keys[2], hash_of(@rows[1..2])]
+    send_command   Commands::ROWS, @keys[0], [] # the 6 rows after the first
+    expect_quit_and_close
+
+    assert_equal @rows[0..0],
+                 query("SELECT * FROM footbl ORDER BY col1")
+  end
+
   test_each "accepts matching hashes and asked for the hash of the next row(s), doubling the number of rows" do
     setup_with_footbl
 
@@ -123,7 +201,8 @@ class SyncToTest < KitchenSync::EndpointTestCase
     expect_handshake_commands
     expect_command Commands::SCHEMA
     send_command   Commands::SCHEMA, "tables" => [footbl_def]
-    expect_command Commands::OPEN, ["footbl"]
+    expect_command Commands::SELECT_TABLE, ["footbl"]
+    expect_command Commands::ROWS, [[], []]
     send_results   Commands::ROWS,
                    [[], []],
                    [2, nil, nil],
@@ -167,8 +246,7 @@ class SyncToTest < KitchenSync::EndpointTestCase
     expect_handshake_commands
     expect_command Commands::SCHEMA
     send_command   Commands::SCHEMA, "tables" => [texttbl_def]
-    expect_command Commands::OPEN, ["texttbl"]
-    send_command   Commands::HASH_NEXT, [], @keys[0], hash_of(@rows[0..0])
+    expect_command Commands::SELECT_TABLE, ["texttbl"]
     expect_command Commands::ROWS, [[], []]
     send_results   Commands::ROWS,
                    [[], []],
@@ -211,8 +289,7 @@ class SyncToTest < KitchenSync::EndpointTestCase
     expect_handshake_commands
     expect_command Commands::SCHEMA
     send_command   Commands::SCHEMA, "tables" => [texttbl_def]
-    expect_command Commands::OPEN, ["texttbl"]
-    send_command   Commands::HASH_NEXT, [], @keys[0], hash_of(@rows[0..0])
+    expect_command Commands::SELECT_TABLE, ["texttbl"]
     expect_command Commands::ROWS, [[], []]
     send_results   Commands::ROWS,
                    [[], []],
@@ -236,8 +313,7 @@ class SyncToTest < KitchenSync::EndpointTestCase
     expect_handshake_commands
     expect_command Commands::SCHEMA
     send_command   Commands::SCHEMA, "tables" => [misctbl_def]
-    expect_command Commands::OPEN, ["misctbl"]
-    send_command   Commands::HASH_NEXT, [], @keys[0], hash_of(@rows[0..0])
+    expect_command Commands::SELECT_TABLE, ["misctbl"]
     expect_command Commands::ROWS, [[], []]
     send_results   Commands::ROWS,
                    [[], []],
@@ -248,6 +324,72 @@ class SyncToTest < KitchenSync::EndpointTestCase
                  query("SELECT * FROM misctbl ORDER BY pri")
   end
 
+  test_each "rebuilds secondary keys after loading all rows into an empty table" do
+    clear_schema
+    create_secondtbl
+
+    @rows = [[9, 968116383, "aa", nil],
+             [2,   2349174, "xy",   1]]
+
+    expect_handshake_commands
+    expect_command Commands::SCHEMA
+    send_command   Commands::SCHEMA, "tables" => [secondtbl_def]
+    expect_command Commands::SELECT_TABLE, ["secondtbl"]
+    expect_command Commands::ROWS, [[], []]
+    send_results   Commands::ROWS,
+                   [[], []],
+                   *@rows
+    expect_quit_and_close
+
+    assert_equal @rows,
+                 query("SELECT * FROM secondtbl ORDER BY pri2, pri1")
+    assert_equal secondtbl_def["keys"].collect {|key| key["name"]}, connection.table_keys("secondtbl")
+  end
+
+  test_each "drops non-unique keys once enough rows have changed, and rebuilds them after the remaining rows" do
+    setup_with_footbl
+    execute "CREATE INDEX another_key ON footbl (another_col)"
+    trace_file = output_file('trace.json')
+    set_to_options :commit_level => "4", :trace_file => trace_file, :defer_keys_after_rows_changed => "1"
+
+    @orig_rows = @rows.collect {|row| row.dup}
+    @rows[0][1] = 11            # changing this row takes us over the threshold
+    @rows << [1002, 12, "new"]  # and this row is inserted afterwards
+    @keys = @rows.collect {|row| [row[0]]}
+
+    expect_handshake_commands
+    expect_command Commands::SCHEMA
+    send_command   Commands::SCHEMA, "tables" => [footbl_def.merge("keys" => [{"name" => "another_key", "unique" => false, "columns" => [1]}])]
+    expect_command Commands::OPEN, ["footbl"]
+    send_command   Commands::HASH_NEXT, [], @keys[0], hash_of(@rows[0..0])
+    expect_command Commands::ROWS_AND_HASH_NEXT, [[], @keys[0], @keys[1], hash_of(@orig_rows[1..1])]
+    send_results   Commands::ROWS,
+                   [[], @keys[0]],
+                   @rows[0]
+    send_command   Commands::HASH_NEXT, @keys[1], @keys[3], hash_of(@rows[2..3])
+    expect_command Commands::HASH_NEXT, [@keys[3], @keys[6], hash_of(@orig_rows[4..6])]
+    send_command   Commands::HASH_NEXT, @keys[6], @keys[7], hash_of(@rows[7..7])
+    expect_command Commands::ROWS, [@keys[6], []]
+    send_results   Commands::ROWS,
+                   [@keys[6], []],
+                   @rows[7]
+    expect_quit_and_close
+    spawner.wait
+
+    assert_equal @rows,
+                 query("SELECT * FROM footbl ORDER BY col1")
+    assert_equal ["another_key"], connection.table_keys("footbl")
+
+    events = JSON.parse(File.read(trace_file))
+    commands = events.select {|event| event["cat"] == "command"}
+    assert_equal %w(HASH_NEXT ROWS HASH_NEXT HASH_NEXT ROWS), commands.collect {|event| event["name"]}
+    drop_keys = events.detect {|event| event["name"] == "drop_keys"}
+    rebuild_keys = events.detect {|event| event["name"] == "rebuild_keys"}
+    assert drop_keys["ts"] >= commands[1]["ts"], "keys should be dropped after the first change"
+    assert drop_keys["ts"] + drop_keys["dur"] <= commands[-1]["ts"], "keys should be dropped before the remaining rows are received"
+    assert rebuild_keys["ts"] >= commands[-1]["ts"] + commands[-1]["dur"], "keys should be rebuilt after the last rows"
+  end
+
   test_each "handles reusing unique values that were previously on later rows" do
     setup_with_footbl
     execute "CREATE UNIQUE INDEX unique_key ON footbl (col3)"
@@ -277,4 +419,253 @@ class SyncToTest < KitchenSync::EndpointTestCase
     assert_equal @rows,
                  query("SELECT * FROM footbl ORDER BY col1")
   end
+
+  test_each "applies changes in the background if requested" do
+    setup_with_footbl
+    execute "CREATE UNIQUE INDEX unique_key ON footbl (col3)"
+    set_to_options :apply_in_background => true
+
+    @orig_rows = @rows.collect {|row| row.dup}
+    @rows[0][-1] = @rows[-1][-1] # reuse this value from the last row
+    @rows[-1][-1] = "new value"  # and change it there to something else
+
+    expect_handshake_commands
+    expect_command Commands::SCHEMA
+    send_command   Commands::SCHEMA, "tables" => [footbl_def.merge("keys" => [{"name" => "unique_key", "unique" => true, "columns" => [2]}])]
+    expect_command Commands::OPEN, ["footbl"]
+    send_command   Commands::HASH_NEXT, [], @keys[0], hash_of(@rows[0..0])
+    expect_command Commands::ROWS_AND_HASH_NEXT, [[], @keys[0], @keys[1], hash_of(@orig_rows[1..1])]
+    send_results   Commands::ROWS,
+                   [[], @keys[0]],
+                   @rows[0]
+    send_command   Commands::HASH_NEXT, @keys[1], @keys[3], hash_of(@rows[2..3])
+    expect_command Commands::HASH_NEXT, [@keys[3], @keys[6], hash_of(@orig_rows[4..6])]
+    send_command   Commands::HASH_NEXT, @keys[3], @keys[4], hash_of(@rows[4..4])
+    expect_command Commands::HASH_NEXT, [@keys[4], @keys[6], hash_of(@orig_rows[5..6])]
+    send_results   Commands::ROWS,
+                   [@keys[6], []],
+                   @rows[6]
+    expect_quit_and_close
+
+    assert_equal @rows,
+                 query("SELECT * FROM footbl ORDER BY col1")
+  end
+
+  test_each "starts tables that are empty at its end first, since their size is unknown" do
+    setup_with_footbl
+    execute(@database_server == 'mysql' ? "ANALYZE TABLE footbl" : "ANALYZE footbl")
+    create_secondtbl
+
+    expect_handshake_commands
+    expect_command Commands::SCHEMA
+    send_command   Commands::SCHEMA, "tables" => [footbl_def, secondtbl_def]
+    expect_command Commands::SELECT_TABLE, ["secondtbl"]
+    expect_command Commands::ROWS, [[], []]
+    send_command   Commands::ROWS, [], []
+    expect_command Commands::OPEN, ["footbl"]
+    send_command   Commands::HASH_NEXT, [], @keys[0], hash_of(@rows[0..0])
+    expect_command Commands::HASH_NEXT, [@keys[0], @keys[2], hash_of(@rows[1..2])]
+    send_command   Commands::HASH_NEXT, @keys[2], @keys[6], hash_of(@rows[3..6])
+    expect_command Commands::ROWS, [@keys[-1], []]
+    send_command   Commands::ROWS, @keys[-1], []
+    expect_quit_and_close
+  end
+
+  test_each "hands over the rest of a table to a worker that has run out of tables, splitting at the middle row" do
+    setup_with_footbl
+    create_secondtbl
+    set_to_options :workers => 2, :minimum_rows_to_share => "2"
+    footbl_worker, secondtbl_worker = start_workers_on_footbl_and_secondtbl
+
+    # once the worker with the empty table is done, it asks the other worker to share the rest of its table
+    spawner.use_worker(secondtbl_worker)
+    expect_command Commands::ROWS, [[], []]
+    send_command   Commands::ROWS, [], []
+    sleep 1 # give it time to make the request before the other worker's next turn
+
+    # it gets the half of the 6 rows after the key in play, so the other worker's range now ends at the 3rd of them
+    spawner.use_worker(footbl_worker)
+    send_command   Commands::HASH_NEXT, [], @keys[0], hash_of(@rows[0..0])
+    expect_command Commands::END_KEY, [@keys[3]]
+    expect_command Commands::HASH_NEXT, [@keys[0], @keys[2], hash_of(@rows[1..2])]
+    send_command   Commands::HASH_NEXT, @keys[2], @keys[3], hash_of(@rows[3..3])
+    expect_command Commands::ROWS, [@keys[3], []]
+    send_command   Commands::ROWS, @keys[3], []
+
+    spawner.use_worker(secondtbl_worker)
+    expect_command Commands::SELECT_TABLE, ["footbl"]
+    expect_command Commands::HASH_NEXT, [@keys[3], @keys[4], hash_of(@rows[4..4])]
+    send_command   Commands::HASH_NEXT, @keys[4], @keys[6], hash_of(@rows[5..6])
+    expect_command Commands::ROWS, [@keys[6], []]
+    send_command   Commands::ROWS, @keys[6], []
+    expect_quit_and_close
+
+    spawner.use_worker(footbl_worker)
+    expect_quit_and_close
+
+    assert_equal @rows,
+                 query("SELECT * FROM footbl ORDER BY col1")
+  end
+
+  test_each "refreshes the statistics of a table split between workers once, after the last range, going by the rows changed in all of them" do
+    setup_with_footbl
+    create_secondtbl
+    metrics_file = output_file('metrics.json')
+    set_to_options :workers => 2, :minimum_rows_to_share => "2", :analyze_after_rows_changed => "3", :metrics_file => metrics_file
+    footbl_worker, secondtbl_worker = start_workers_on_footbl_and_secondtbl
+
+    spawner.use_worker(secondtbl_worker)
+    expect_command Commands::ROWS, [[], []]
+    send_command   Commands::ROWS, [], []
+    sleep 1 # give it time to ask the other worker to share its table
+
+    # neither worker deletes enough rows for the statistics to be stale on its own, but together they do
+    spawner.use_worker(footbl_worker)
+    send_command   Commands::HASH_NEXT, [], @keys[0], hash_of(@rows[0..0])
+    expect_command Commands::END_KEY, [@keys[3]]
+    expect_command Commands::HASH_NEXT, [@keys[0], @keys[2], hash_of(@rows[1..2])]
+    send_command   Commands::ROWS, @keys[2], [] # deletes the 1 row up to the end of its range
+
+    spawner.use_worker(secondtbl_worker)
+    expect_command Commands::SELECT_TABLE, ["footbl"]
+    expect_command Commands::HASH_NEXT, [@keys[3], @keys[4], hash_of(@rows[4..4])]
+    send_command   Commands::ROWS, @keys[4], [] # deletes the 2 rows after that
+    expect_quit_and_close
+
+    spawner.use_worker(footbl_worker)
+    expect_quit_and_close
+    spawner.wait
+
+    assert_equal @rows[0..2] + @rows[4..4],
+                 query("SELECT * FROM footbl ORDER BY col1")
+    footbl_metrics = JSON.parse(File.read(metrics_file))["workers"].collect {|worker| worker["tables"]}.flatten.select {|table| table["table"] == "footbl"}
+    assert_equal 2, footbl_metrics.size
+    assert_equal 1, footbl_metrics.collect {|table| table["tables_analyzed"]}.inject(:+)
+  end
+
+  test_each "reports errors applying changes in the background as sync errors" do
+    clear_schema
+    create_footbl
+    set_to_options :apply_in_background => true
+
+    expect_handshake_commands
+    expect_command Commands::SCHEMA
+    send_command   Commands::SCHEMA, "tables" => [footbl_def]
+    expect_command Commands::SELECT_TABLE, ["footbl"]
+    expect_command Commands::ROWS, [[], []]
+    send_results   Commands::ROWS,
+                   [[], []],
+                   [2, 99999, "test"] # out of range for the smallint column
+    spawner.wait
+
+    assert !$?.signaled?, "terminated by signal #{$?.termsig}"
+    assert_match /out of range/i, spawner.stderr_contents if spawner.capture_stderr_in
+    assert_equal [],
+                 query("SELECT * FROM footbl ORDER BY col1")
+  end
+
+  test_each "writes metrics for the table it was working on when the sync fails" do
+    clear_schema
+    create_footbl
+    metrics_file = output_file('metrics.json')
+    set_to_options :metrics_file => metrics_file
+
+    expect_handshake_commands
+    expect_command Commands::SCHEMA
+    send_command   Commands::SCHEMA, "tables" => [footbl_def]
+    expect_command Commands::SELECT_TABLE, ["footbl"]
+    expect_command Commands::ROWS, [[], []]
+    send_results   Commands::ROWS,
+                   [[], []],
+                   [2, 99999, "test"] # out of range for the smallint column
+    spawner.wait
+
+    metrics = JSON.parse(File.read(metrics_file))
+    assert_equal ["footbl"], metrics["workers"][0]["tables"].collect {|table| table["table"]}
+    assert_equal 1, metrics["workers"][0]["tables"][0]["round_trips"]
+  end
+
+  test_each "writes metrics for each table to the given file" do
+    setup_with_footbl
+    metrics_file = output_file('metrics.json')
+    set_to_options :metrics_file => metrics_file
+
+    expect_handshake_commands
+    expect_command Commands::SCHEMA
+    send_command   Commands::SCHEMA, "tables" => [footbl_def]
+    expect_command Commands::OPEN, ["footbl"]
+    send_command   Commands::HASH_NEXT, [], @keys[0], hash_of(@rows[0..0])
+    expect_command Commands::HASH_NEXT, [@keys[0], @keys[2], hash_of(@rows[1..2])]
+    send_command   Commands::HASH_NEXT, @keys[2], @keys[6], hash_of(@rows[3..6])
+    expect_command Commands::ROWS, [@keys[-1], []]
+    send_command   Commands::ROWS, @keys[-1], []
+    expect_quit_and_close
+    spawner.wait
+
+    metrics = JSON.parse(File.read(metrics_file))
+    assert_equal 1, metrics["workers"].size
+    assert_equal ["footbl"], metrics["workers"][0]["tables"].collect {|table| table["table"]}
+    table = metrics["workers"][0]["tables"][0]
+    assert_equal 2, table["hash_commands"]
+    assert_equal 1, table["rows_commands"]
+    assert_equal 3, table["round_trips"]
+    assert_equal 0, table["rows_inserted"] + table["rows_updated"] + table["rows_deleted"]
+    assert_equal [0, 1, 0, 1], table["hashed_range_rows_histogram"] # we checked their hashes of 1 and 4 rows
+    assert_equal 0, table["tables_analyzed"]
+    assert table["bytes_received"] > 0
+    assert metrics["workers"][0]["bytes_sent"] >= table["bytes_sent"]
+  end
+
+  test_each "refreshes the statistics of tables after changing a large part of them, and reports it in the metrics" do
+    clear_schema
+    create_footbl
+    metrics_file = output_file('metrics.json')
+    set_to_options :metrics_file => metrics_file
+
+    @rows = (1..1000).collect {|n| [n, n, "row #{n}"]}
+
+    expect_handshake_commands
+    expect_command Commands::SCHEMA
+    send_command   Commands::SCHEMA, "tables" => [footbl_def]
+    expect_command Commands::SELECT_TABLE, ["footbl"]
+    expect_command Commands::ROWS, [[], []]
+    send_results   Commands::ROWS,
+                   [[], []],
+                   *@rows
+    expect_quit_and_close
+    spawner.wait
+
+    assert_equal @rows,
+                 query("SELECT * FROM footbl ORDER BY col1")
+    table = JSON.parse(File.read(metrics_file))["workers"][0]["tables"][0]
+    assert_equal 1000, table["rows_inserted"]
+    assert_equal 1, table["tables_analyzed"]
+  end
+
+  test_each "writes a trace of the commands and queries to the given file" do
+    setup_with_footbl
+    trace_file = output_file('trace.json')
+    set_to_options :trace_file => trace_file
+
+    expect_handshake_commands
+    expect_command Commands::SCHEMA
+    send_command   Commands::SCHEMA, "tables" => [footbl_def]
+    expect_command Commands::OPEN, ["footbl"]
+    send_command   Commands::HASH_NEXT, [], @keys[0], hash_of(@rows[0..0])
+    expect_command Commands::HASH_NEXT, [@keys[0], @keys[2], hash_of(@rows[1..2])]
+    send_command   Commands::HASH_NEXT, @keys[2], @keys[6], hash_of(@rows[3..6])
+    expect_command Commands::ROWS, [@keys[-1], []]
+    send_command   Commands::ROWS, @keys[-1], []
+    expect_quit_and_close
+    spawner.wait
+
+    events = JSON.parse(File.read(trace_file))
+    assert_equal ["ks to"], events.select {|event| event["name"] == "process_name"}.collect {|event| event["args"]["name"]}
+    assert_equal %w(OPEN HASH_NEXT ROWS QUIT), events.select {|event| event["cat"] == "send"}.collect {|event| event["name"]}.reject {|name| %w(PROTOCOL TARGET_BLOCK_SIZE WITHOUT_SNAPSHOT SCHEMA).include?(name)}
+    commands = events.select {|event| event["cat"] == "command"}
+    assert_equal %w(HASH_NEXT HASH_NEXT ROWS), commands.collect {|event| event["name"]}
+    assert_equal ["footbl"], commands.collect {|event| event["args"]["table"]}.uniq
+    assert events.any? {|event| event["cat"] == "db" && event["name"] == "retrieve_rows"}
+    assert events.select {|event| event["ph"] == "X"}.all? {|event| event["ts"] > 0 && event["dur"] >= 0}
+  end
 end
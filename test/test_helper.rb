@@ -3,6 +3,7 @@ require 'rubygems'
 require 'test/unit'
 require 'fileutils'
 require 'time'
+require 'json'
 
 require 'msgpack'
 require 'pg'
@@ -260,6 +261,8 @@ module Commands
   HASH_FAIL = 4
   ROWS_AND_HASH_NEXT = 5
   ROWS_AND_HASH_FAIL = 6
+  SELECT_TABLE = 7
+  END_KEY = 8
 
   PROTOCOL = 32
   EXPORT_SNAPSHOT  = 33
@@ -268,6 +271,7 @@ module Commands
   WITHOUT_SNAPSHOT = 36
   SCHEMA = 37
   TARGET_BLOCK_SIZE = 38
+  BINARY_KEY_ORDER = 39
   QUIT = 0
 end
 
@@ -275,7 +279,7 @@ Verbs = Commands.constants.each_with_object({}) {|k, results| results[Commands.c
 
 module KitchenSync
   class TestCase < Test::Unit::TestCase
-    PROTOCOL_VERSION_SUPPORTED = 5
+    PROTOCOL_VERSION_SUPPORTED = 9
 
     undef_method :default_test if instance_methods.include? 'default_test' or
                                   instance_methods.include? :default_test
@@ -289,7 +293,7 @@ module KitchenSync
     end
 
     def spawner
-      @spawner ||= KitchenSyncSpawner.new(binary_path, program_args, :capture_stderr_in => captured_stderr_filename).tap(&:start_binary)
+      @spawner ||= KitchenSyncSpawner.new(binary_path, program_args, :capture_stderr_in => captured_stderr_filename, :workers => @workers).tap(&:start_binary)
     end
 
     def unpacker